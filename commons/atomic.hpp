@@ -200,6 +200,33 @@ namespace Atomic
     MAKE_LOCKED_FUNCTIONS(Clear, long,  "andq %1,%0",  "ir", ~v);
 
     #endif
+
+    // Acquire loads and release stores, for variables with a single writer
+    // (no locked instruction needed). On older compilers, x86 ordering plus
+    // a compiler barrier gives the same guarantees for aligned words.
+
+    template < typename ValType >
+    inline ValType doLoad(volatile ValType * p)
+    {
+    #if defined(__ATOMIC_ACQUIRE)
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    #else
+        ValType v = *p;
+        asm volatile("" ::: "memory");
+        return v;
+    #endif
+    }
+
+    template < typename ValType >
+    inline void doStore(volatile ValType * p, ValType v)
+    {
+    #if defined(__ATOMIC_RELEASE)
+        __atomic_store_n(p, v, __ATOMIC_RELEASE);
+    #else
+        asm volatile("" ::: "memory");
+        *p = v;
+    #endif
+    }
 };
 
 #endif /* _ATOMIC_HPP_ */
@@ -43,7 +43,8 @@
 
 K3LAPI::K3LAPI()
 : _device_count(0),  _channel_count(0),  _link_count(0),
-  _device_config(0), _channel_config(0), _link_config(0)
+  _device_config(0), _channel_config(0), _link_config(0),
+  _command_count(0)
 {};
 
 /* initialize the whole thing! */
@@ -149,6 +150,14 @@ void K3LAPI::command(int32 dev, int32 obj, int32 code, std::string & str)
 }
 
 void K3LAPI::command (int32 dev, int32 obj, int32 code, const char * parms)
+{
+    int32 rc = command_status(dev, obj, code, parms);
+
+    if (rc != ksSuccess)
+        throw failed_command(code, dev, obj, rc);
+}
+
+int32 K3LAPI::command_status (int32 dev, int32 obj, int32 code, const char * parms)
 {
     K3L_COMMAND cmd;
 
@@ -156,10 +165,9 @@ void K3LAPI::command (int32 dev, int32 obj, int32 code, const char * parms)
     cmd.Object = obj;
     cmd.Params = (byte *)parms;
 
-    int32 rc = k3lSendCommand(dev, &cmd);
+    Atomic::doAdd(&_command_count);
 
-    if (rc != ksSuccess)
-        throw failed_command(code, dev, obj, rc);
+    return k3lSendCommand(dev, &cmd);
 }
 
 void K3LAPI::raw_command(int32 dev, int32 dsp, std::string & str)
@@ -55,6 +55,7 @@
 #endif
 
 #include <types.hpp>
+#include <atomic.hpp>
 
 #ifndef _K3LAPI_HPP_
 #define _K3LAPI_HPP_
@@ -219,6 +220,15 @@ struct K3LAPI
     void command (int32 dev, int32 obj, int32 code, std::string & str);
     void command (int32 dev, int32 obj, int32 code, const char * parms = NULL);
 
+    /* same as above, but returns the status instead of throwing */
+    int32 command_status (int32 dev, int32 obj, int32 code, const char * parms = NULL);
+
+    /* number of commands sent since start */
+    unsigned long command_count(void)
+    {
+        return _command_count;
+    }
+
     /* obter dados 'cacheados' (sem identificadores) */
 
     inline unsigned int channel_count(int32 dev)
@@ -317,6 +327,11 @@ struct K3LAPI
         command((int32)tgt.device, (int32)tgt.object, code, parms);
     };
 
+    int32 command_status (target & tgt, int32 code, const char * parms = NULL)
+    {
+        return command_status((int32)tgt.device, (int32)tgt.object, code, parms);
+    };
+
     /* obter dados 'cacheados' (com indentificadores) */
 
     inline unsigned int channel_count(target & tgt)
@@ -380,6 +395,8 @@ struct K3LAPI
     channel_ptr_conf_type *  _channel_config;
        link_ptr_conf_type *     _link_config;
               KDeviceType *     _device_type;
+
+    volatile unsigned long    _command_count;
 };
 
 #endif /* _K3LAPI_HPP_ */
@@ -0,0 +1,349 @@
+/*
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2009 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License Version 1.1
+  (the "License"); you may not use this file except in compliance with the
+  License. You may obtain a copy of the License at http://www.mozilla.org/MPL/
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file under
+  the MPL, indicate your decision by deleting the provisions above and replace them
+  with the notice and other provisions required by the LGPL License. If you do not
+  delete the provisions above, a recipient may use your version of this file under
+  either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+/* Bounded multi-producer, single-consumer queue (lock-free).
+
+   Each slot has a sequence number, telling whose turn it is: the slot for
+   position 'p' is free for a producer when its sequence is 'p', and ready
+   for the consumer when it is 'p + 1'. Producers claim positions with a
+   compare-and-swap on the enqueue position, fill the slot, and publish it
+   with a release store of its sequence; so producers never take a mutex or
+   sleep, and a slow producer only delays the consumer, never other ones.
+   The consumer owns the dequeue position and gives slots back to producers
+   by moving their sequence one lap ahead.
+
+   Slots are raw storage: elements are constructed in place by producers
+   (placement new, see emplace) and destroyed in place by consumer_commit,
+   so the consumer works on the element inside the queue and nothing gets
+   copied in or out besides what the element constructor does.
+
+   A claimed slot must always be published, as the consumer takes slots in
+   order and would wait on it forever. So if an element constructor throws,
+   emplace publishes the slot as a tombstone (no element in it), which the
+   consumer gives back without looking at, and reports the element as not
+   queued (counted as a failure) instead of throwing: producers are often
+   library callbacks, where exceptions can not go through.
+
+   The queue holds slots_for(size) elements (size rounded up to a power of
+   two), and keeps the number of failed enqueues (queue full, or a throwing
+   constructor) and the most elements ever waiting (high-water mark).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include <noncopyable.hpp>
+#include <atomic.hpp>
+
+#ifndef _MPSC_QUEUE_HPP_
+#define _MPSC_QUEUE_HPP_
+
+#define MPSC_CACHE_LINE 64
+
+template < typename T >
+struct MpscQueue: public NonCopyable
+{
+    struct BufferFull  {};
+    struct BufferEmpty {};
+
+    struct Slot
+    {
+        volatile uint32_t sequence;
+
+        /* published without an element (see emplace) */
+        bool              dead;
+
+        /* where the element is constructed */
+        void * place(void) { return (void *)_storage; }
+
+        T & value(void) { return *reinterpret_cast< T * >(_storage); }
+
+     protected:
+        char _storage[sizeof(T)] __attribute__((aligned(__alignof__(T))));
+    };
+
+    MpscQueue(unsigned int size)
+    : _slots(slots_for(size)),
+      _mask(_slots - 1),
+      _buffer(new Slot[_slots]),
+      _failures(0),
+      _high_water(0)
+    {
+        reset();
+    };
+
+    ~MpscQueue()
+    {
+        /* destroys whatever was left */
+        clear();
+
+        delete[] _buffer;
+    }
+
+    static unsigned int slots_for(unsigned int size)
+    {
+        unsigned int slots = 1;
+
+        while (slots < size)
+            slots <<= 1;
+
+        return slots;
+    }
+
+    unsigned int capacity(void) { return _slots; }
+
+    /* statistics (may be read from any thread) */
+    unsigned long failures(void)   { return _failures;   }
+    unsigned int  high_water(void) { return _high_water; }
+
+    /* elements waiting (or being written by producers) */
+    unsigned int count(void)
+    {
+        const uint32_t dequeue = Atomic::doLoad(&_dequeue);
+
+        return Atomic::doLoad(&_enqueue) - dequeue;
+    }
+
+    /***** PRODUCER FUNCTIONS (any number of threads) *****/
+
+    /* claims the next slot, or returns NULL if the queue is full; an element *
+     * must be constructed at slot->place(), and then given to commit().      */
+    Slot * provider_start(void)
+    {
+        uint32_t pos = Atomic::doLoad(&_enqueue);
+
+        do
+        {
+            Slot & slot = _buffer[pos & _mask];
+
+            const int32_t diff = (int32_t)(Atomic::doLoad(&slot.sequence) - pos);
+
+            if (diff == 0)
+            {
+                if (__sync_bool_compare_and_swap(&_enqueue, pos, pos + 1))
+                {
+                    mark(pos + 1 - Atomic::doLoad(&_dequeue));
+                    return &slot;
+                }
+            }
+            else if (diff < 0)
+            {
+                /* the consumer has not given this slot back yet */
+                Atomic::doAdd(&_failures);
+                return NULL;
+            }
+
+            pos = Atomic::doLoad(&_enqueue);
+        }
+        while (true);
+    }
+
+    /* makes the slot (and the element in it) visible to the consumer */
+    void provider_commit(Slot * slot)
+    {
+        slot->dead = false;
+
+        Atomic::doStore(&slot->sequence, slot->sequence + 1);
+    }
+
+    /* makes the slot visible to the consumer as having no element, *
+     * for when constructing it failed; the consumer skips it.      */
+    void provider_abort(Slot * slot)
+    {
+        slot->dead = true;
+
+        Atomic::doStore(&slot->sequence, slot->sequence + 1);
+
+        Atomic::doAdd(&_failures);
+    }
+
+    /* constructs the element in place, as T(arg); returns false if the *
+     * queue is full or if the constructor threw (see the notes above). */
+    template < typename A >
+    bool emplace(const A & arg)
+    {
+        Slot * slot = provider_start();
+
+        if (!slot)
+            return false;
+
+        try
+        {
+            new (slot->place()) T(arg);
+        }
+        catch (...)
+        {
+            provider_abort(slot);
+            return false;
+        }
+
+        provider_commit(slot);
+
+        return true;
+    }
+
+    bool provide(const T & value)
+    {
+        return emplace(value);
+    }
+
+    /***** CONSUMER FUNCTIONS (one thread) *****/
+
+    /* true if the oldest element was not published yet */
+    bool empty(void)
+    {
+        /* tombstones are not elements: give them back right away */
+        while (published() && _buffer[_dequeue & _mask].dead)
+            release();
+
+        return !published();
+    }
+
+    /* oldest element, which stays in the queue until consumer_commit() */
+    T & consumer_start(void)
+    {
+        if (empty())
+            throw BufferEmpty();
+
+        return _buffer[_dequeue & _mask].value();
+    }
+
+    /* destroys the oldest element, giving its slot back */
+    void consumer_commit(void)
+    {
+        _buffer[_dequeue & _mask].value().~T();
+
+        release();
+    }
+
+    bool consume(T & value)
+    {
+        try
+        {
+            value = consumer_start();
+        }
+        catch (BufferEmpty & e)
+        {
+            return false;
+        }
+
+        consumer_commit();
+
+        return true;
+    }
+
+    /* should only be called when queue is not being used */
+    void clear()
+    {
+        while (!empty())
+            consumer_commit();
+
+        reset();
+    }
+
+ protected:
+    /* oldest slot was published by its producer */
+    bool published(void)
+    {
+        return (Atomic::doLoad(&_buffer[_dequeue & _mask].sequence) == _dequeue + 1);
+    }
+
+    /* gives the oldest slot back */
+    void release(void)
+    {
+        const uint32_t pos = _dequeue;
+
+        /* one lap ahead: free for the producer of position 'pos + slots' */
+        Atomic::doStore(&_buffer[pos & _mask].sequence, pos + _slots);
+        Atomic::doStore(&_dequeue, pos + 1);
+    }
+
+    void reset()
+    {
+        for (unsigned int i = 0; i < _slots; i++)
+        {
+            _buffer[i].sequence = i;
+            _buffer[i].dead     = false;
+        }
+
+        _enqueue = 0;
+        _dequeue = 0;
+    }
+
+    /* keeps the high-water mark (producers race on it, hence the CAS) */
+    void mark(unsigned int depth)
+    {
+        unsigned int current = _high_water;
+
+        while (depth > current)
+        {
+            if (__sync_bool_compare_and_swap(&_high_water, current, depth))
+                break;
+
+            current = _high_water;
+        }
+    }
+
+ protected:
+    const unsigned int      _slots;
+    const unsigned int      _mask;
+
+    Slot                  * _buffer;
+
+    volatile unsigned long  _failures;
+    volatile unsigned int   _high_water;
+
+    char _pad_shared[MPSC_CACHE_LINE];
+
+    /* claimed by producers */
+    volatile uint32_t       _enqueue;
+
+    char _pad_enqueue[MPSC_CACHE_LINE];
+
+    /* owned by the consumer */
+    volatile uint32_t       _dequeue;
+
+    char _pad_dequeue[MPSC_CACHE_LINE];
+};
+
+#endif /* _MPSC_QUEUE_HPP_ */
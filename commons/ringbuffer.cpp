@@ -81,7 +81,7 @@ bool Ringbuffer_traits::traits_provide(char * buffer, const char * value, unsign
          *
          */
 
-        if ((_size - (writer - reader + 1)) <= amount)
+        if ((writer - reader + 1) >= _size || (_size - (writer - reader + 1)) <= amount) /* also full when writer is at the end and reader at 0 */
         {
             if (skip_overwrite)
                 return false;
@@ -151,7 +151,7 @@ unsigned int Ringbuffer_traits::traits_consume(const char * buffer, char * value
     const unsigned int writer = _pointers.writer.complete;
     const unsigned int reader = _pointers.reader.complete;
 
-    const bool writer_less = writer < reader;
+    const bool writer_less = writer <= reader; /* equal when full */
 
     unsigned int total = 0;
 
@@ -211,7 +211,7 @@ unsigned int Ringbuffer_traits::traits_consume_begins(const char * buffer, char
     const unsigned int reader = cache.reader.complete;
     const unsigned int writer = cache.writer.complete;
 
-    const bool writer_less = writer < reader;
+    const bool writer_less = writer <= reader; /* equal when full */
 
     unsigned int total = 0;
 
@@ -258,7 +258,7 @@ bool Ringbuffer_traits::traits_consume_commit(unsigned int amount)
    	const unsigned int writer = cache.writer.complete;
     const unsigned int reader = cache.reader.complete;
 
-    const bool writer_less = writer < reader;
+    const bool writer_less = writer <= reader; /* equal when full */
 
     unsigned int total = 0;
 
@@ -336,7 +336,7 @@ bool Ringbuffer_traits::traits_provide_partial(char * buffer, const char * value
          *
          */
 
-        if ((size - (writer - reader + 1)) <= amount)
+        if ((writer - reader + 1) >= size || (size - (writer - reader + 1)) <= amount) /* also full when writer is at the end and reader at 0 */
             return false;
 
         unsigned int wr1 = size - writer + 1; /* writer is already 1 position after */
@@ -383,7 +383,7 @@ unsigned int Ringbuffer_traits::traits_consume_partial(const char * buffer, char
 
 //    fprintf(stderr, "%p> consume partial: %d/%d [%d/%d]\n", this, reader, writer, amount, size);
 
-    const bool writer_less = writer < reader;
+    const bool writer_less = writer <= reader; /* equal when full */
 
     unsigned int total = 0;
 
@@ -449,7 +449,7 @@ unsigned int Ringbuffer_traits::traits_put(const char * buffer, std::ostream &fd
     const unsigned int reader = cache.reader.complete;
     const unsigned int writer = cache.writer.complete;
 
-    const bool writer_less = writer < reader;
+    const bool writer_less = writer <= reader; /* equal when full */
 
     unsigned int total = 0;
 
@@ -532,7 +532,7 @@ unsigned int Ringbuffer_traits::traits_get(char * buffer, std::istream &fd, unsi
          *
          */
 
-        if ((_size - (writer - reader + 1)) <= amount)
+        if ((writer - reader + 1) >= _size || (_size - (writer - reader + 1)) <= amount) /* also full when writer is at the end and reader at 0 */
             return false;
 
         unsigned int wr1 = _size - writer + 1; /* writer is already 1 position after */
@@ -51,6 +51,7 @@
 #include <string.h>
 
 #include <cmath>
+#include <algorithm>
 #include <iostream>
 
 #include <noncopyable.hpp>
@@ -194,7 +195,8 @@ struct Ringbuffer: protected Ringbuffer_traits, public NonCopyable
         const unsigned long r = cache.reader.complete;
         const unsigned long w = cache.writer.complete;
 
-        return (((r - w) != 1) && (!(r == 0 && w == _size)));
+        /* writer is one position ahead: full if the next write would reach the reader */
+        return ((w % _size) != r);
     }
 
     bool may_read(Buffer_table & cache)
@@ -228,6 +230,14 @@ struct Ringbuffer: protected Ringbuffer_traits, public NonCopyable
         index.partial = 0;
     }
 
+    /* number of complete elements ready to be consumed */
+    unsigned int count(void)
+    {
+        Buffer_table cache = _pointers;
+
+        return (unsigned int)(((cache.writer.complete - 1) + _size - cache.reader.complete) % _size);
+    }
+
     /***** BUFFER FUNCTIONS *****/
 
     bool provide(const T & value)
@@ -372,6 +382,84 @@ struct Ringbuffer: protected Ringbuffer_traits, public NonCopyable
 //        fprintf(stderr, "%p> read: %d/%d [%d/%d]\n", this, _pointers.reader, _pointers.writer, _pointers.reader_partial, _pointers.writer_partial);
     }
 
+    /***** ZERO-COPY CONSUMER FUNCTIONS *****/
+
+    /* marks up to 'max' elements at the reader (contiguous in memory) as in use by  *
+     * the consumer, returning how many were marked. they stay inside the buffer, so *
+     * the provider can neither overwrite nor discard them until consumer_release(). *
+     * the number of held elements is kept in the (otherwise unused) partial field   *
+     * of the reader, so marking races correctly with provider_discard.              */
+    unsigned int consumer_hold(unsigned int max)
+    {
+        do
+        {
+            Buffer_table cache = _pointers;
+
+            if (!may_read(cache) || cache.reader.partial != 0)
+                return 0;
+
+            const unsigned int r = cache.reader.complete;
+
+            const unsigned int avail = ((cache.writer.complete - 1) + _size - r) % _size;
+
+            unsigned int amount = std::min(max, avail);
+
+            /* do not wrap around */
+            amount = std::min(amount, _size - r);
+
+            Buffer_pointer index(r, amount);
+
+            if (update(cache.reader, index))
+                return amount;
+        }
+        while (true);
+    }
+
+    /* first element held by consumer_hold() */
+    T & consumer_held(void)
+    {
+        return _buffer[_pointers.reader.complete];
+    }
+
+    unsigned int held(void)
+    {
+        return _pointers.reader.partial;
+    }
+
+    /* gives back the elements held, making room for the provider */
+    void consumer_release(void)
+    {
+        do
+        {
+            Buffer_pointer cache = _pointers.reader;
+
+            if (cache.partial == 0)
+                return;
+
+            Buffer_pointer index((cache.complete + cache.partial) % _size, 0);
+
+            if (update(cache, index))
+                return;
+        }
+        while (true);
+    }
+
+    /* discards the oldest element, so the provider can make room in a full buffer.  *
+     * returns false if the buffer was empty, the consumer moved the reader first,   *
+     * or the oldest element is being held by the consumer (see consumer_hold).      */
+    bool provider_discard(void)
+    {
+        Buffer_table   cache = _pointers;
+        Buffer_pointer index = cache.reader;
+
+        if (!may_read(cache) || cache.reader.partial != 0)
+            return false;
+
+        reader_next(cache.reader, index);
+
+        return update(cache.reader, index);
+    }
+
     /* writes everything or nothing, but works on bytes (may write incomplete elements) */
     /* WARNING: do not mix this with full element provider */
     inline bool provider_partial(const char *buffer, unsigned int amount)
@@ -0,0 +1,239 @@
+/*
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2009 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License Version 1.1
+  (the "License"); you may not use this file except in compliance with the
+  License. You may obtain a copy of the License at http://www.mozilla.org/MPL/
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file under
+  the MPL, indicate your decision by deleting the provisions above and replace them
+  with the notice and other provisions required by the LGPL License. If you do not
+  delete the provisions above, a recipient may use your version of this file under
+  either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+
+#include <shm_ringbuffer.hpp>
+
+bool ShmRingbuffer::failed(std::string what)
+{
+    _error = what + ": " + strerror(errno);
+    return false;
+}
+
+bool ShmRingbuffer::create(std::string name, unsigned int element_size, unsigned int size)
+{
+    close();
+
+    const unsigned int capacity  = slots_for(size);
+    const unsigned int slot_size = (sizeof(Slot) + element_size + SHM_CACHE_LINE - 1) & ~(SHM_CACHE_LINE - 1);
+
+    const size_t length = sizeof(Header) + ((size_t)capacity * slot_size);
+
+    /* a segment left by a previous run may have another layout: start over */
+    shm_unlink(name.c_str());
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0640);
+
+    if (fd < 0)
+        return failed("unable to create '" + name + "'");
+
+    if (ftruncate(fd, length) != 0)
+    {
+        failed("unable to resize '" + name + "'");
+
+        ::close(fd);
+        shm_unlink(name.c_str());
+
+        return false;
+    }
+
+    void * addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (addr == MAP_FAILED)
+    {
+        failed("unable to map '" + name + "'");
+        shm_unlink(name.c_str());
+
+        return false;
+    }
+
+    _header = (Header *)addr;
+    _length = length;
+    _owner  = true;
+    _name   = name;
+
+    /* segment is zero-filled: only what differs from zero is set */
+    _header->header_size    = sizeof(Header);
+    _header->element_size   = element_size;
+    _header->slot_size      = slot_size;
+    _header->capacity       = capacity;
+    _header->producer_pid   = (uint32_t)getpid();
+
+    for (unsigned int i = 0; i < capacity; i++)
+        slot_at(i)->sequence = i;
+
+    _header->version = version;
+
+    /* readers trust the header once they see the magic */
+    Atomic::doStore(&_header->producer_state, (uint32_t)PS_RUNNING);
+    Atomic::doStore((volatile uint32_t *)&_header->magic, magic);
+
+    return true;
+}
+
+bool ShmRingbuffer::attach(std::string name)
+{
+    close();
+
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+
+    if (fd < 0)
+        return failed("unable to open '" + name + "'");
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return failed("unable to check '" + name + "'");
+    }
+
+    const size_t length = (size_t)st.st_size;
+
+    if (length < sizeof(Header))
+    {
+        ::close(fd);
+
+        _error = "segment '" + name + "' is too small";
+        return false;
+    }
+
+    void * addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (addr == MAP_FAILED)
+        return failed("unable to map '" + name + "'");
+
+    Header * header = (Header *)addr;
+
+    const char * problem = NULL;
+
+    if (Atomic::doLoad((volatile uint32_t *)&header->magic) != magic)
+        problem = "has no (or a wrong) magic number";
+    else if (header->version != version)
+        problem = "has an unsupported version";
+    else if (header->header_size < sizeof(Header) || header->capacity == 0 ||
+             (header->capacity & (header->capacity - 1)) != 0 ||
+             header->slot_size < sizeof(Slot) + header->element_size ||
+             header->header_size + ((size_t)header->capacity * header->slot_size) > length)
+        problem = "has an inconsistent header";
+
+    if (problem)
+    {
+        munmap(addr, length);
+
+        _error = "segment '" + name + "' " + problem;
+        return false;
+    }
+
+    _header = header;
+    _length = length;
+    _owner  = false;
+    _name   = name;
+
+    return true;
+}
+
+void ShmRingbuffer::close(void)
+{
+    if (!_header)
+        return;
+
+    if (_owner)
+    {
+        Atomic::doStore(&_header->producer_state, (uint32_t)PS_CLOSED);
+
+        /* attached readers keep their mapping, new ones will not find it */
+        shm_unlink(_name.c_str());
+    }
+
+    munmap((void *)_header, _length);
+
+    _header = NULL;
+    _length = 0;
+    _owner  = false;
+}
+
+bool ShmRingbuffer::producer_alive(void)
+{
+    if (!_header || Atomic::doLoad(&_header->producer_state) != PS_RUNNING)
+        return false;
+
+    /* producer may have died without closing */
+    return (kill((pid_t)_header->producer_pid, 0) == 0 || errno == EPERM);
+}
+
+ShmRingbuffer::Slot * ShmRingbuffer::provider_start(void)
+{
+    uint32_t pos = Atomic::doLoad(&_header->enqueue);
+
+    do
+    {
+        Slot * slot = slot_at(pos);
+
+        const int32_t diff = (int32_t)(Atomic::doLoad(&slot->sequence) - pos);
+
+        if (diff == 0)
+        {
+            if (__sync_bool_compare_and_swap(&_header->enqueue, pos, pos + 1))
+                return slot;
+        }
+        else if (diff < 0)
+        {
+            /* consumer is late (or absent) */
+            Atomic::doAdd(&_header->dropped);
+            return NULL;
+        }
+
+        pos = Atomic::doLoad(&_header->enqueue);
+    }
+    while (true);
+}
@@ -0,0 +1,217 @@
+/*
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2009 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License Version 1.1
+  (the "License"); you may not use this file except in compliance with the
+  License. You may obtain a copy of the License at http://www.mozilla.org/MPL/
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file under
+  the MPL, indicate your decision by deleting the provisions above and replace them
+  with the notice and other provisions required by the LGPL License. If you do not
+  delete the provisions above, a recipient may use your version of this file under
+  either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+/* Ringbuffer in a named POSIX shared-memory segment, for consumers living
+   in other processes.
+
+   The segment starts with a versioned header (element size, capacity,
+   indices, producer pid/state/heartbeat) followed by the slots. It works as
+   the MpscQueue: each slot has a sequence number, producers (any number of
+   threads in the creating process) claim positions with a CAS and publish
+   them with a release store, and a single consumer (one process at a time)
+   gives slots back; both indices live in the segment, so a consumer may
+   detach and another one continue from the same point. Producers never
+   wait for consumers: when the ring is full the element is dropped and
+   counted in the header.
+
+   Readers should check magic, version and header_size before using the
+   rest of the header (attach does this); new fields only go at the end.
+ */
+
+#include <stdint.h>
+
+#include <string>
+
+#include <noncopyable.hpp>
+#include <atomic.hpp>
+
+#ifndef _SHM_RINGBUFFER_HPP_
+#define _SHM_RINGBUFFER_HPP_
+
+#define SHM_CACHE_LINE 64
+
+struct ShmRingbuffer: public NonCopyable
+{
+    static const uint32_t magic   = 0x4b53524eu; /* "KSRN" */
+    static const uint32_t version = 1;
+
+    typedef enum
+    {
+        PS_CLOSED  = 0,
+        PS_RUNNING = 1,
+    }
+    ProducerState;
+
+    struct Header
+    {
+        uint32_t          magic;
+        uint32_t          version;
+        uint32_t          header_size;   /* offset of the first slot */
+        uint32_t          element_size;  /* usable bytes per slot */
+        uint32_t          slot_size;     /* distance between slots */
+        uint32_t          capacity;      /* slots (power of two) */
+
+        volatile uint32_t producer_pid;
+        volatile uint32_t producer_state;
+        volatile uint32_t heartbeat;     /* producer clock (ms), at last publish */
+        volatile uint32_t dropped;       /* elements lost with the ring full */
+
+        char _pad_info[SHM_CACHE_LINE - (10 * sizeof(uint32_t))];
+
+        volatile uint32_t enqueue;       /* claimed by producers */
+        char _pad_enqueue[SHM_CACHE_LINE - sizeof(uint32_t)];
+
+        volatile uint32_t dequeue;       /* owned by the consumer */
+        char _pad_dequeue[SHM_CACHE_LINE - sizeof(uint32_t)];
+    };
+
+    struct Slot
+    {
+        volatile uint32_t sequence;
+        uint32_t          size;          /* bytes used in data */
+        char              data[0];
+    };
+
+    ShmRingbuffer()
+    : _header(NULL), _length(0), _owner(false) {};
+
+    ~ShmRingbuffer()
+    {
+        close();
+    }
+
+    /* producer side: (re)creates the segment, holding 'size' elements (rounded *
+     * up to a power of two) of 'element_size' bytes.                           */
+    bool create(std::string name, unsigned int element_size, unsigned int size);
+
+    /* consumer side: maps an existing segment, checking its header */
+    bool attach(std::string name);
+
+    /* unmaps the segment; the producer marks it closed and removes the name */
+    void close(void);
+
+    bool opened(void) { return (_header != NULL); }
+
+    /* why create/attach failed */
+    const std::string & error(void) { return _error; }
+
+    Header * header(void) { return _header; }
+
+    /* true if the producer did not close the segment and its process exists */
+    bool producer_alive(void);
+
+    /***** PRODUCER FUNCTIONS (any number of threads) *****/
+
+    /* claims a slot, or returns NULL (and counts a drop) if the ring is full; *
+     * the slot must be filled and then given to provider_commit().           */
+    Slot * provider_start(void);
+
+    void provider_commit(Slot * slot, unsigned int size, uint32_t heartbeat)
+    {
+        slot->size = size;
+
+        /* avoid bouncing the header line between producers for nothing */
+        if (_header->heartbeat != heartbeat)
+            _header->heartbeat = heartbeat;
+
+        Atomic::doStore(&slot->sequence, slot->sequence + 1);
+    }
+
+    /***** CONSUMER FUNCTIONS (one process) *****/
+
+    /* oldest element, or NULL if empty; it stays there until consumer_commit() */
+    Slot * consumer_start(void)
+    {
+        const uint32_t pos = _header->dequeue;
+
+        Slot * slot = slot_at(pos);
+
+        if (Atomic::doLoad(&slot->sequence) != pos + 1)
+            return NULL;
+
+        return slot;
+    }
+
+    void consumer_commit(void)
+    {
+        const uint32_t pos = _header->dequeue;
+
+        Atomic::doStore(&(slot_at(pos)->sequence), pos + _header->capacity);
+        Atomic::doStore(&_header->dequeue, pos + 1);
+    }
+
+    /* elements waiting (or being written by producers) */
+    unsigned int count(void)
+    {
+        const uint32_t dequeue = Atomic::doLoad(&_header->dequeue);
+
+        return Atomic::doLoad(&_header->enqueue) - dequeue;
+    }
+
+    static unsigned int slots_for(unsigned int size)
+    {
+        unsigned int slots = 1;
+
+        while (slots < size)
+            slots <<= 1;
+
+        return slots;
+    }
+
+ protected:
+    Slot * slot_at(uint32_t pos)
+    {
+        return (Slot *)(((char *)_header) + _header->header_size +
+            ((pos & (_header->capacity - 1)) * _header->slot_size));
+    }
+
+    bool failed(std::string what);
+
+ protected:
+    Header      * _header;
+    size_t        _length;
+
+    bool          _owner;
+    std::string   _name;
+    std::string   _error;
+};
+
+#endif /* _SHM_RINGBUFFER_HPP_ */
@@ -0,0 +1,304 @@
+/*
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2009 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License Version 1.1
+  (the "License"); you may not use this file except in compliance with the
+  License. You may obtain a copy of the License at http://www.mozilla.org/MPL/
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file under
+  the MPL, indicate your decision by deleting the provisions above and replace them
+  with the notice and other provisions required by the LGPL License. If you do not
+  delete the provisions above, a recipient may use your version of this file under
+  either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+#include <spsc_ringbuffer.hpp>
+
+SpscRingbuffer_traits::SpscRingbuffer_traits(unsigned int block, unsigned int size)
+: _block(block),
+  _size(size > 1 ? size - 1 : 1),
+  _slots(slots_for(size)),
+  _mask(_slots - 1)
+{
+    traits_clear();
+}
+
+unsigned int SpscRingbuffer_traits::slots_for(unsigned int size)
+{
+    unsigned int slots = 1;
+
+    while (slots < size)
+        slots <<= 1;
+
+    return slots;
+}
+
+void SpscRingbuffer_traits::traits_clear(void)
+{
+    _reader         = 0;
+    _writer_cache   = 0;
+    _reader_start   = 0;
+    _reader_partial = 0;
+
+    _writer         = 0;
+    _reader_cache   = 0;
+    _writer_partial = 0;
+}
+
+void SpscRingbuffer_traits::advance(uint32_t reader, unsigned int amount)
+{
+    const uint32_t index = (index_of(reader) + amount) & index_mask;
+
+    while (!update(reader, index))
+    {
+        const uint32_t current = load_reader();
+
+        /* the provider discarded them already */
+        if (distance(index_of(reader), index_of(current)) >= amount)
+            return;
+
+        reader = current;
+    }
+}
+
+bool SpscRingbuffer_traits::make_room(unsigned int amount)
+{
+    do
+    {
+        const uint32_t reader = load_reader();
+
+        /* elements being used by the consumer can't be dropped */
+        if (held_of(reader) != 0)
+            return false;
+
+        const unsigned int room = _size - distance(index_of(reader), _writer);
+
+        if (room >= amount)
+            break;
+
+        if (update(reader, (index_of(reader) + amount - room) & index_mask))
+            break;
+    }
+    while (true);
+
+    _reader_cache = index_of(load_reader());
+
+    return true;
+}
+
+void SpscRingbuffer_traits::write_bytes(char * buffer, unsigned int offset, const char * value, unsigned int amount)
+{
+    const unsigned int total = _slots * _block;
+    const unsigned int first = std::min(amount, total - offset);
+
+    /* at the end, then at the beginning (if going around) */
+    memcpy((void *) &(buffer[offset]), (const void *)  (value),        first);
+    memcpy((void *)  (buffer),         (const void *) &(value[first]), amount - first);
+}
+
+void SpscRingbuffer_traits::read_bytes(const char * buffer, unsigned int offset, char * value, unsigned int amount)
+{
+    const unsigned int total = _slots * _block;
+    const unsigned int first = std::min(amount, total - offset);
+
+    memcpy((void *)  (value),        (const void *) &(buffer[offset]), first);
+    memcpy((void *) &(value[first]), (const void *)  (buffer),         amount - first);
+}
+
+/********** BUFFER FUNCTIONS **********/
+
+/* writes everything or nothing (unless overwriting, when oldest elements are dropped) */
+bool SpscRingbuffer_traits::traits_provide(char * buffer, const char * value, unsigned int amount, bool skip_overwrite)
+{
+    if (amount > _size)
+        return false;
+
+    bool ret = true;
+
+    if (writable(amount) < amount)
+    {
+        if (skip_overwrite || !make_room(amount))
+            return false;
+
+        ret = false;
+    }
+
+    write_bytes(buffer, (_writer & _mask) * _block, value, amount * _block);
+
+    store_writer(_writer + amount);
+
+    return ret;
+}
+
+/* returns the number of itens that have been read */
+unsigned int SpscRingbuffer_traits::traits_consume(const char * buffer, char * value, unsigned int amount, bool atomic_mode)
+{
+    const uint32_t reader = load_reader();
+    const uint32_t index  = index_of(reader);
+
+    const unsigned int total = std::min(readable(index, amount), amount);
+
+    if ((total == 0) || (atomic_mode && (total < amount)))
+        return 0;
+
+    read_bytes(buffer, (index & _mask) * _block, value, total * _block);
+
+    advance(reader, total);
+
+    return total;
+}
+
+/********** TWO-PHASE BUFFER FUNCTIONS ***********/
+
+/* returns the number of itens that have been read */
+unsigned int SpscRingbuffer_traits::traits_consume_begins(const char * buffer, char * value, unsigned int amount, bool atomic_mode)
+{
+    const uint32_t reader = load_reader();
+    const uint32_t index  = index_of(reader);
+
+    const unsigned int total = std::min(readable(index, amount), amount);
+
+    if ((total == 0) || (atomic_mode && (total < amount)))
+        return 0;
+
+    read_bytes(buffer, (index & _mask) * _block, value, total * _block);
+
+    _reader_start = reader;
+
+    return total;
+}
+
+bool SpscRingbuffer_traits::traits_consume_commit(unsigned int amount)
+{
+    if (readable(index_of(_reader_start), amount) < amount)
+        return false;
+
+    advance(_reader_start, amount);
+
+    return true;
+}
+
+/********** PARTIAL BUFFER FUNCTIONS (bytes) ***********/
+
+/* writes everything or nothing */
+bool SpscRingbuffer_traits::traits_provide_partial(char * buffer, const char * value, unsigned int amount)
+{
+    const unsigned int room = (writable(_size) * _block) - _writer_partial;
+
+    if (amount > room)
+        return false;
+
+    write_bytes(buffer, ((_writer & _mask) * _block) + _writer_partial, value, amount);
+
+    /* only complete elements are given to the consumer */
+    const unsigned int bytes = _writer_partial + amount;
+
+    _writer_partial = bytes % _block;
+
+    store_writer(_writer + (bytes / _block));
+
+    return true;
+}
+
+/* returns the number of bytes that have been read */
+unsigned int SpscRingbuffer_traits::traits_consume_partial(const char * buffer, char * value, unsigned int amount)
+{
+    const uint32_t reader = load_reader();
+    const uint32_t index  = index_of(reader);
+
+    const unsigned int avail = (readable(index, _size) * _block) - _reader_partial;
+
+    const unsigned int total = std::min(avail, amount);
+
+    if (total == 0)
+        return 0;
+
+    read_bytes(buffer, ((index & _mask) * _block) + _reader_partial, value, total);
+
+    const unsigned int bytes = _reader_partial + total;
+
+    _reader_partial = bytes % _block;
+
+    if (bytes >= _block)
+        advance(reader, bytes / _block);
+
+    return total;
+}
+
+/********** IO FUNCTIONS **********/
+
+/* returns the number of items written to from buffer to stream */
+unsigned int SpscRingbuffer_traits::traits_put(const char * buffer, std::ostream &fd, unsigned int amount)
+{
+    const uint32_t reader = load_reader();
+    const uint32_t index  = index_of(reader);
+
+    const unsigned int total = std::min(readable(index, amount), amount);
+
+    if (total == 0)
+        return 0;
+
+    const unsigned int slot  = index & _mask;
+    const unsigned int first = std::min(total, _slots - slot);
+
+    fd.write((const char *) &(buffer[slot * _block]), _block * first);
+    fd.write((const char *)  (buffer),                _block * (total - first));
+
+    advance(reader, total);
+
+    return total;
+}
+
+/* returns number of items read from stream to buffer */
+unsigned int SpscRingbuffer_traits::traits_get(char * buffer, std::istream &fd, unsigned int amount)
+{
+    if (writable(amount) < amount)
+        return 0;
+
+    const unsigned int slot  = _writer & _mask;
+    const unsigned int first = std::min(amount, _slots - slot);
+
+    unsigned int char_amount = 0;
+
+    fd.read((char *) &(buffer[slot * _block]), _block * first);
+    char_amount += fd.gcount();
+
+    if (fd.gcount() == (int)(_block * first) && amount > first)
+    {
+        fd.read((char *) (buffer), _block * (amount - first));
+        char_amount += fd.gcount();
+    }
+
+    const unsigned int real_amount = char_amount / _block;
+
+    store_writer(_writer + real_amount);
+
+    return real_amount;
+}
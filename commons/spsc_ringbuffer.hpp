@@ -0,0 +1,517 @@
+/*
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2009 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License Version 1.1
+  (the "License"); you may not use this file except in compliance with the
+  License. You may obtain a copy of the License at http://www.mozilla.org/MPL/
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file under
+  the MPL, indicate your decision by deleting the provisions above and replace them
+  with the notice and other provisions required by the LGPL License. If you do not
+  delete the provisions above, a recipient may use your version of this file under
+  either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*/
+
+/* Single-producer, single-consumer ringbuffer, with the same interface as
+   Ringbuffer (see ringbuffer.hpp), so users can switch over unchanged.
+
+   The reader and the writer indexes live on separate cache lines: each side
+   only writes its own index (release store) and reads the other one (acquire
+   load) only when its cached copy says the buffer is full or empty. Storage
+   is rounded up to a power of two slots, and indexes run free (over 24 bits)
+   being masked into the buffer.
+
+   The reader index is also written by the provider on provider_discard, and
+   it keeps the number of elements held by the consumer (see consumer_hold)
+   in its upper 8 bits; so the reader is moved with compare-and-swap, which
+   only contends with the provider when it is discarding.
+
+   WARNING: as in Ringbuffer, do not mix partial (byte) and element functions.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <noncopyable.hpp>
+#include <atomic.hpp>
+
+#ifndef _SPSC_RINGBUFFER_HPP_
+#define _SPSC_RINGBUFFER_HPP_
+
+#define SPSC_CACHE_LINE 64
+
+struct SpscRingbuffer_traits
+{
+    static const uint32_t index_mask = 0x00ffffff;
+    static const uint32_t held_shift = 24;
+    static const uint32_t held_max   = 0xff;
+
+    SpscRingbuffer_traits(unsigned int block, unsigned int size);
+
+    /* number of slots (a power of two) used to store a buffer of 'size' */
+    static unsigned int slots_for(unsigned int size);
+
+    /* number of slots of storage */
+    unsigned int slots(void) { return _slots; }
+
+ protected:
+    static inline uint32_t index_of(uint32_t reader) { return reader & index_mask; }
+    static inline uint32_t  held_of(uint32_t reader) { return reader >> held_shift; }
+
+    static inline uint32_t distance(uint32_t from, uint32_t to) { return (to - from) & index_mask; }
+
+    inline uint32_t load_reader(void) { return Atomic::doLoad(&_reader); }
+    inline uint32_t load_writer(void) { return Atomic::doLoad(&_writer); }
+
+    inline void store_writer(uint32_t value) { Atomic::doStore(&_writer, value & index_mask); }
+
+    inline bool update(uint32_t cache, uint32_t value)
+    {
+        return __sync_bool_compare_and_swap(&_reader, cache, value);
+    }
+
+    /* room for the provider, reloading the reader only if 'wanted' does not fit */
+    inline unsigned int writable(unsigned int wanted)
+    {
+        unsigned int room = _size - distance(_reader_cache, _writer);
+
+        if (room < wanted)
+        {
+            _reader_cache = index_of(load_reader());
+            room = _size - distance(_reader_cache, _writer);
+        }
+
+        return room;
+    }
+
+    /* elements after 'index' for the consumer, reloading the writer only if *
+     * there are less than 'wanted' (or the copy is older than the reader,   *
+     * which happens when the provider discards).                            */
+    inline unsigned int readable(uint32_t index, unsigned int wanted)
+    {
+        unsigned int avail = distance(index, _writer_cache);
+
+        if (avail < wanted || avail > _size)
+        {
+            _writer_cache = load_writer();
+            avail = distance(index, _writer_cache);
+        }
+
+        return avail;
+    }
+
+    /* moves the reader 'amount' elements from 'reader', unless the provider *
+     * has discarded them meanwhile.                                         */
+    void advance(uint32_t reader, unsigned int amount);
+
+    /* drops the oldest elements until there is room for 'amount' (provider) */
+    bool make_room(unsigned int amount);
+
+    void write_bytes(char *, unsigned int offset, const char *, unsigned int);
+    void  read_bytes(const char *, unsigned int offset, char *, unsigned int);
+
+    bool         traits_provide(      char *, const char *, unsigned int, bool);
+    unsigned int traits_consume(const char *,       char *, unsigned int, bool);
+
+    unsigned int traits_consume_begins(const char *, char *, unsigned int, bool);
+    bool         traits_consume_commit(unsigned int);
+
+    bool         traits_provide_partial(      char *, const char *, unsigned int);
+    unsigned int traits_consume_partial(const char *,       char *, unsigned int);
+
+    unsigned int traits_get(      char *, std::istream &, unsigned int);
+    unsigned int traits_put(const char *, std::ostream &, unsigned int);
+
+    void traits_clear(void);
+
+ protected:
+    const unsigned int _block;
+    const unsigned int _size;   /* capacity (in elements) */
+    const unsigned int _slots;
+    const unsigned int _mask;
+
+    char _pad_shared[SPSC_CACHE_LINE];
+
+    /* consumer side (the provider only writes here on discards) */
+    volatile uint32_t  _reader;
+    uint32_t           _writer_cache;
+    uint32_t           _reader_start;   /* reader seen by consumer_start */
+    unsigned int       _reader_partial; /* bytes already read from the reader slot */
+
+    char _pad_reader[SPSC_CACHE_LINE];
+
+    /* provider side */
+    volatile uint32_t  _writer;
+    uint32_t           _reader_cache;
+    unsigned int       _writer_partial; /* bytes already written in the writer slot */
+
+    char _pad_writer[SPSC_CACHE_LINE];
+};
+
+template <typename T>
+struct SpscRingbuffer: protected SpscRingbuffer_traits, public NonCopyable
+{
+    struct BufferFull  {};
+    struct BufferEmpty {};
+
+    using SpscRingbuffer_traits::slots_for;
+    using SpscRingbuffer_traits::slots;
+
+    /* holds up to 'size - 1' elements, as Ringbuffer does */
+    SpscRingbuffer(unsigned int size)
+    : SpscRingbuffer_traits(sizeof(T), size)
+    {
+        _buffer = new T[_slots];
+        _malloc = true;
+    };
+
+    /* 'buffer' should have room for 'slots_for(size)' elements */
+    SpscRingbuffer(unsigned int size, T * buffer)
+    : SpscRingbuffer_traits(sizeof(T), size)
+    {
+        _buffer = buffer;
+        _malloc = false;
+    };
+
+    ~SpscRingbuffer()
+    {
+        if (_malloc)
+          delete[] _buffer;
+    }
+
+    /* number of complete elements ready to be consumed */
+    unsigned int count(void)
+    {
+        const uint32_t reader = index_of(load_reader());
+
+        return distance(reader, load_writer());
+    }
+
+    /***** BUFFER FUNCTIONS *****/
+
+    bool provide(const T & value)
+    {
+        if (!writable(1))
+            return false;
+
+        _buffer[_writer & _mask] = value;
+
+        store_writer(_writer + 1);
+
+        return true;
+    }
+
+    bool consume(T & value)
+    {
+        const uint32_t reader = load_reader();
+
+        if (!readable(index_of(reader), 1))
+            return false;
+
+        value = _buffer[index_of(reader) & _mask];
+
+        advance(reader, 1);
+
+        return true;
+    }
+
+    /* writes everything or nothing */
+    inline bool provide(const T * value, unsigned int amount, bool skip_overwrite = true)
+    {
+        return traits_provide((char *)_buffer, (const char *) value, amount, skip_overwrite);
+    }
+
+    /* returns the number of items that have been read (atomic_mode == true means 'all or nothing') */
+    inline unsigned int consume(T * value, unsigned int amount, bool atomic_mode = false)
+    {
+        return traits_consume((const char *)_buffer, (char *) value, amount, atomic_mode);
+    }
+
+    /***** TWO-PHASE BUFFER FUNCTIONS *****/
+
+    /* returns the number of items that have been read (atomic_mode == true means 'all or nothing') */
+    inline unsigned int consume_begins(T * value, unsigned int amount, bool atomic_mode = false)
+    {
+        return traits_consume_begins((const char *)_buffer, (char *) value, amount, atomic_mode);
+    }
+
+    /* returns true if we could commit that much of buffer (use only after consume_begins).    *
+     * note: you may commit less bytes that have been read to keep some data inside the buffer */
+    inline bool consume_commit(unsigned int amount)
+    {
+        return traits_consume_commit(amount);
+    }
+
+    /***** TWO-PHASE SINGLE-ELEMENT BUFFER FUNCTIONS *****/
+
+    T & provider_start(void)
+    {
+        if (!writable(1))
+            throw BufferFull();
+
+        return _buffer[_writer & _mask];
+    }
+
+    void provider_commit(void)
+    {
+        store_writer(_writer + 1);
+    }
+
+    T & consumer_start(void)
+    {
+        const uint32_t reader = load_reader();
+
+        if (!readable(index_of(reader), 1))
+            throw BufferEmpty();
+
+        _reader_start = reader;
+
+        return _buffer[index_of(reader) & _mask];
+    }
+
+    void consumer_commit(void)
+    {
+        advance(_reader_start, 1);
+    }
+
+    /***** ZERO-COPY CONSUMER FUNCTIONS *****/
+
+    /* marks up to 'max' elements at the reader (contiguous in memory) as in use by *
+     * the consumer, returning how many were marked. they stay inside the buffer,  *
+     * so the provider can neither overwrite nor discard them until released.      */
+    unsigned int consumer_hold(unsigned int max)
+    {
+        do
+        {
+            const uint32_t reader = load_reader();
+
+            if (held_of(reader) != 0)
+                return 0;
+
+            const uint32_t index = index_of(reader);
+
+            unsigned int amount = std::min(max, readable(index, max));
+
+            /* do not wrap around */
+            amount = std::min(amount, _slots - (index & _mask));
+            amount = std::min(amount, (unsigned int)held_max);
+
+            if (!amount)
+                return 0;
+
+            if (update(reader, index | (amount << held_shift)))
+                return amount;
+        }
+        while (true);
+    }
+
+    /* first element held by consumer_hold() (or the oldest one, if none is held) */
+    T & consumer_held(void)
+    {
+        return _buffer[index_of(load_reader()) & _mask];
+    }
+
+    unsigned int held(void)
+    {
+        return held_of(load_reader());
+    }
+
+    /* slot of the oldest element (held or not) and how many complete elements *
+     * follow it, from a single load of each index; lets a third thread walk  *
+     * the elements in place without ever going past the writer.              */
+    unsigned int snapshot(unsigned int & first)
+    {
+        const uint32_t reader = index_of(load_reader());
+
+        first = reader & _mask;
+
+        return distance(reader, load_writer());
+    }
+
+    /* gives back the elements held without consuming them: they stay at the *
+     * reader, to be held again later (or discarded by the provider).        */
+    void consumer_unhold(void)
+    {
+        do
+        {
+            const uint32_t reader = load_reader();
+
+            if (!held_of(reader))
+                return;
+
+            if (update(reader, index_of(reader)))
+                return;
+        }
+        while (true);
+    }
+
+    /* gives back the elements held, making room for the provider */
+    void consumer_release(void)
+    {
+        do
+        {
+            const uint32_t reader = load_reader();
+            const uint32_t amount = held_of(reader);
+
+            if (!amount)
+                return;
+
+            if (update(reader, (index_of(reader) + amount) & index_mask))
+                return;
+        }
+        while (true);
+    }
+
+    /* discards the oldest element, so the provider can make room in a full buffer. *
+     * returns false if the buffer was empty, the consumer moved the reader first,  *
+     * or the oldest element is being held by the consumer (see consumer_hold).     */
+    bool provider_discard(void)
+    {
+        const uint32_t reader = load_reader();
+
+        if (held_of(reader) != 0 || distance(index_of(reader), _writer) == 0)
+            return false;
+
+        return update(reader, (index_of(reader) + 1) & index_mask);
+    }
+
+    /* writes everything or nothing, but works on bytes (may write incomplete elements) */
+    /* WARNING: do not mix this with full element provider */
+    inline bool provider_partial(const char *buffer, unsigned int amount)
+    {
+        return traits_provide_partial((char *)_buffer, buffer, amount);
+    }
+
+    /* returns the number of bytes that have been read (only from complete elements) */
+    /* WARNING: do not mix this with full element consumer */
+    inline unsigned int consumer_partial(char *buffer, unsigned int amount)
+    {
+        return traits_consume_partial((const char *)_buffer, buffer, amount);
+    }
+
+    /***** ZERO-COPY SPAN FUNCTIONS *****/
+
+    /* contiguous region inside the buffer, in elements */
+    struct Span
+    {
+        T *          data;
+        unsigned int size;
+    };
+
+    /* as in Ringbuffer, but in elements (bytes, for a ring of chars): each call  *
+     * fills 'spans' with up to two regions (the second one is empty unless the  *
+     * data wraps around) and returns their total size; data stays where it is,  *
+     * and nothing moves until the matching commit, which may be for less than   *
+     * was returned.                                                             *
+     * WARNING: do not mix these with consumer_hold or the partial functions.    */
+
+    /* up to 'max' elements ready to be consumed */
+    unsigned int read_spans(Span spans[2], unsigned int max = UINT_MAX)
+    {
+        const uint32_t index = index_of(load_reader());
+
+        return fill_spans(spans, index, std::min(readable(index, max), max));
+    }
+
+    /* returns false (and does nothing) if there are less than 'amount' elements */
+    bool read_commit(unsigned int amount)
+    {
+        const uint32_t reader = load_reader();
+
+        if (readable(index_of(reader), amount) < amount)
+            return false;
+
+        advance(reader, amount);
+
+        return true;
+    }
+
+    /* up to 'max' elements of free space for the provider */
+    unsigned int write_spans(Span spans[2], unsigned int max = UINT_MAX)
+    {
+        return fill_spans(spans, _writer, std::min(writable(max), max));
+    }
+
+    /* returns false (and does nothing) if there is no room for 'amount' elements */
+    bool write_commit(unsigned int amount)
+    {
+        if (writable(amount) < amount)
+            return false;
+
+        store_writer(_writer + amount);
+
+        return true;
+    }
+
+    /***** IO FUNCTIONS *****/
+
+    /* returns the number of items written to from buffer to stream */
+    inline unsigned int put(std::ostream &fd, unsigned int amount)
+    {
+        return traits_put((const char *)_buffer, fd, amount);
+    }
+
+    /* returns number of items read from stream to buffer */
+    inline unsigned int get(std::istream &fd, unsigned int amount)
+    {
+        return traits_get((char *)_buffer, fd, amount);
+    }
+
+    /* should only be called when buffer is not being used */
+    void clear()
+    {
+        traits_clear();
+    }
+
+ protected:
+    unsigned int fill_spans(Span spans[2], uint32_t index, unsigned int total)
+    {
+        const unsigned int offset = index & _mask;
+        const unsigned int first  = std::min(total, _slots - offset);
+
+        spans[0].data = &(_buffer[offset]);
+        spans[0].size = first;
+
+        spans[1].data = _buffer;
+        spans[1].size = total - first;
+
+        return total;
+    }
+
+ protected:
+    T *  _buffer;
+    bool _malloc;
+};
+
+#endif /* _SPSC_RINGBUFFER_HPP_ */
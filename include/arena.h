@@ -0,0 +1,86 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdlib.h>
+
+/* Single memory region for the audio buffers of all channels.               *
+ *                                                                           *
+ * It is allocated once (when boards are initialized), optionally backed by  *
+ * huge pages, and locked in RAM, so the audio path never faults on it.      *
+ * Allocations are cache-line aligned and zeroed; they are made only while   *
+ * channels are being created (no locking), and are never given back, except *
+ * when everything is released at finalize. If the arena is not available or *
+ * gets exhausted, memory comes from the heap instead; as with new, alloc()  *
+ * throws std::bad_alloc if even that fails.                                 */
+struct AudioArena
+{
+    static const size_t cache_line = 64;
+
+    static size_t align(size_t size)
+    {
+        return (size + cache_line - 1) & ~(cache_line - 1);
+    }
+
+    static bool initialize(size_t size, bool hugepages, bool lock);
+    static void finalize(void);
+
+    static void * alloc(size_t size);
+    static void   release(void * ptr);
+
+    static bool contains(void * ptr)
+    {
+        return ((char *)ptr >= _base && (char *)ptr < _base + _size);
+    }
+
+ protected:
+    static char   * _base;
+    static size_t   _size;
+    static size_t   _used;
+    static bool     _hugepages;
+    static bool     _locked;
+};
+
+#endif /* _ARENA_H_ */
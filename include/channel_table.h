@@ -0,0 +1,108 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+
+#ifndef _CHANNEL_TABLE_H_
+#define _CHANNEL_TABLE_H_
+
+#include <stdlib.h>
+
+#include <atomic.hpp>
+
+/* Dense (device, object) table of channels, for exception-free lookups on *
+ * the audio and event paths (see Board::lookup). It is filled while the   *
+ * channels are created, and not changed after that; disable() only makes  *
+ * lookups fail, the storage is kept until finalize(), which should only   *
+ * be called once nothing can call lookup() anymore.                       */
+template < typename T >
+struct ChannelTable
+{
+    ChannelTable(): _table(NULL), _devices(0), _objects(0) {};
+
+    bool initialize(unsigned int devices, unsigned int objects)
+    {
+        _table   = (T **)calloc(devices * objects, sizeof(T *));
+        _objects = objects;
+
+        Atomic::doStore(&_devices, (_table ? devices : 0u));
+
+        return (_table != NULL);
+    }
+
+    void finalize(void)
+    {
+        disable();
+
+        _objects = 0;
+
+        free(_table);
+        _table = NULL;
+    }
+
+    /* makes every lookup fail from now on */
+    void disable(void)
+    {
+        Atomic::doStore(&_devices, 0u);
+    }
+
+    void set(unsigned int device, unsigned int object, T * value)
+    {
+        if (device < _devices && object < _objects)
+            _table[(device * _objects) + object] = value;
+    }
+
+    T * lookup(unsigned int device, unsigned int object)
+    {
+        if (device >= _devices || object >= _objects)
+            return NULL;
+
+        return _table[(device * _objects) + object];
+    }
+
+ protected:
+    T                    ** _table;
+    volatile unsigned int   _devices;
+    unsigned int            _objects;
+};
+
+#endif /* _CHANNEL_TABLE_H_ */
@@ -120,10 +120,16 @@
 #define KHOMP_READ_PACKET_SIZE    (KHOMP_READ_PACKET_TIME *   8) // asterisk sample size (bytes)
 
 #define KHOMP_MIN_READ_PACKET_SIZE (10 * 8)                      // min size to return on khomp_read
-#define KHOMP_MAX_READ_PACKET_SIZE (30 * 8)                      // max size to return on khomp_read
+#define KHOMP_MAX_READ_PACKET_SIZE (60 * 8)                      // max size to return on khomp_read
 
 #define KHOMP_AUDIO_BUFFER_SIZE   (KHOMP_READ_PACKET_SIZE  *  8) // buffer size (bytes)
 
+#define KHOMP_AUDIO_BUFFER_LENGTH       4                        // default buffer length (packets)
+#define KHOMP_MIN_AUDIO_BUFFER_LENGTH   3                        // min buffer length (packets)
+#define KHOMP_MAX_AUDIO_BUFFER_LENGTH  32                        // max buffer length (packets)
+
+#define KHOMP_NATIVE_BRIDGE_WAIT      100                        // reader wait while natively bridged (ms)
+
 
 #define DBG(x,y) \
     { \
@@ -45,20 +45,85 @@
 #define _FRAME_HPP_
 
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 
-#include <ringbuffer.hpp>
+#include <algorithm>
+#include <string>
+
+#include <spsc_ringbuffer.hpp>
 
 #include "globals.h"
+#include "stats.h"
 
 struct FrameStorage
 {
     static const unsigned int frame_count = 6;
     static const unsigned int audio_count = 4;
 
-    FrameStorage(switch_codec_t * codec, int packet_size);
+    /* what to do when audio arrives and the buffer is full */
+    typedef enum
+    {
+        BP_DROP_NEWEST,      /* discard incoming audio */
+        BP_DROP_OLDEST,      /* discard the oldest packet in buffer */
+        BP_COMPRESS_SILENCE, /* discard incoming silence, or else the oldest packet */
+    }
+    PolicyType;
+
+    /* occupancy in packets, delay in ms (log2 scale: 0, 1, 2-3, ..., 64+) */
+    typedef Histogram < 8 > OccupancyHistogram;
+    typedef Histogram < 8 > DelayHistogram;
+
+    /* buffer counters, kept for each direction of each channel */
+    struct Stats
+    {
+        Stats() { clear(); }
+
+        void clear()
+        {
+            overflows  = 0;
+            dropped    = 0;
+            silenced   = 0;
+            suppressed = 0;
+            flushed    = 0;
+
+            occupancy.clear();
+            delay.clear();
+        }
+
+        unsigned long overflows;  /*!< times the buffer was found full */
+        unsigned long dropped;    /*!< audio discarded by the policy */
+        unsigned long silenced;   /*!< silence discarded while full */
+        unsigned long suppressed; /*!< silent packets replaced by CNG */
+        unsigned long flushed;    /*!< stale packets discarded by flush() */
+
+        OccupancyHistogram occupancy; /*!< packets buffered, on every new packet */
+        DelayHistogram     delay;     /*!< time from given to picked */
+    };
+
+    /* information about each packet in the audio buffer */
+    struct SlotInfo
+    {
+        uint32_t      stamp;     /* when it was completed (ms) */
+        bool          silent;    /* see FrameManager::vad */
+        volatile bool processed; /* see FrameManager::batched */
+    };
+
+    FrameStorage(switch_codec_t * codec, int packet_size, unsigned int count = audio_count);
     virtual ~FrameStorage();
 
+    static bool policy_from_name(const std::string &, PolicyType &);
+    static const char * policy_name(PolicyType);
+
+    /* memory used by a storage with 'count' slots of 'slot_size' bytes */
+    static size_t storage_size(unsigned int slot_size, unsigned int count);
+
+    /* memory used by the audio buffer alone (see 'audio_buffer_count') */
+    static size_t buffer_size(unsigned int slot_size, unsigned int count);
+
+    /* true if A-law audio in buffer is below the silence threshold */
+    static bool silent(const char * buf, unsigned int size);
+
     inline switch_frame_t * next_frame(void)
     {
         return &(_frames[next_index()]);
@@ -84,77 +149,525 @@ struct FrameStorage
         return _buffer;
     };
 
+    SlotInfo * slot_info()
+    {
+        return _info;
+    };
+
+    /* monotonic time in ms, for delay measurements */
+    static inline uint32_t now_ms(void)
+    {
+        return (uint32_t)(switch_micro_time_now() / 1000);
+    }
+
+    unsigned int audio_buffer_count()
+    {
+        return _count;
+    };
+
+    /* reallocates the audio buffer for 'count' packets (storage is rounded *
+     * up to a power of two slots, as the ringbuffer needs).                */
+    void audio_buffer_count(unsigned int count);
+
+    /* adjusts frame lengths to a new packet size (in bytes) */
+    void packet_size(unsigned int size);
+
+    unsigned int packet_size(void)
+    {
+        return _packet_size;
+    }
+
+    /* gives the frame the next timestamp (in samples) and sequence number */
+    inline void stamp(switch_frame_t * f)
+    {
+        f->timestamp = _timestamp;
+        f->seq       = _seq++;
+
+        _timestamp += f->samples;
+    }
+
+    inline void restart(void)
+    {
+        _timestamp = 0u;
+        _seq       = 0u;
+    }
+
  private:
     switch_frame_t   _cng_frame;
 
     switch_frame_t * _frames;
     char           * _buffer;
+    SlotInfo       * _info;
 
     unsigned int     _index;
+
+    unsigned int     _slot_size;
+    unsigned int     _packet_size;
+    unsigned int     _count;
+
+    uint32_t         _timestamp;
+    uint16_t         _seq;
 };
 
-/* Internal frame array structure. */
+/* Internal frame array structure.                                         *
+ *                                                                         *
+ * Works as a repacketizer: each ring slot holds S bytes at most, but only *
+ * 'packet_size()' bytes of it are used. Data given in any chunk size is   *
+ * accumulated into the slot being filled, and the remainder is carried   *
+ * over to the next slot (and to the next call, if needed).                */
 template < int S >
 struct FrameManager: protected FrameStorage
 {
     typedef char Packet[ S ];
 
-    typedef Ringbuffer < Packet >  AudioBuffer;
+    typedef SpscRingbuffer < Packet >  AudioBuffer;
 
     FrameManager(switch_codec_t * codec)
     : FrameStorage(codec, S),
-      _audio(audio_count, (Packet*)audio_buffer())
+      _audio(new AudioBuffer(audio_buffer_count(), (Packet*)audio_buffer())),
+      _policy(BP_DROP_NEWEST),
+      _fill(0),
+      _vad(false),
+      _hangover(0),
+      _hang(0),
+      _batched(false)
     {};
 
-//    ~FrameManager();
+    ~FrameManager()
+    {
+        delete _audio;
+    }
+
+    /* should only be called when buffer is not being used */
+    void buffer_length(unsigned int count)
+    {
+        if (count == audio_buffer_count())
+            return;
+
+        /* may throw, leaving the current buffer in place */
+        audio_buffer_count(count);
+
+        delete _audio;
+
+        _audio = new AudioBuffer(audio_buffer_count(), (Packet*)audio_buffer());
+
+        clear();
+    }
+
+    unsigned int buffer_length(void)
+    {
+        return audio_buffer_count();
+    }
+
+    /* packets waiting to be picked */
+    unsigned int count(void)
+    {
+        return _audio->count() - _audio->held();
+    }
+
+    /* how many packets the buffer can hold */
+    unsigned int capacity(void)
+    {
+        return audio_buffer_count() - 1;
+    }
+
+    void policy(PolicyType p)
+    {
+        _policy = p;
+    }
+
+    PolicyType policy(void)
+    {
+        return _policy;
+    }
+
+    Stats & stats(void)
+    {
+        return _stats;
+    }
+
+    /* enables replacing silent packets by CNG frames on pick(), keeping *
+     * audio flowing for 'hangover' ms after speech so endings are kept. *
+     * should be called after packet_size(), with buffer not being used. */
+    void vad(bool enabled, unsigned int hangover)
+    {
+        _vad      = enabled;
+        _hangover = (hangover + packet_duration() - 1) / packet_duration();
+        _hang     = _hangover;
+    }
+
+    bool vad(void)
+    {
+        return _vad;
+    }
+
+    /* in batched mode, per-packet work (silence classification and whatever *
+     * 'process' is given) is done by a media thread instead of the provider *
+     * and the consumer; packets are only picked after being processed.      *
+     * should only be called when buffer is not being used.                  */
+    void batched(bool enabled)
+    {
+        _batched = enabled;
+    }
+
+    bool batched(void)
+    {
+        return _batched;
+    }
+
+    /* runs 'fun(data, size)' over the packets not processed yet, in place, *
+     * returning how many were processed. must be called from one thread.   *
+     * 'processed' is published with release/acquire: the provider sets it  *
+     * after writing a packet, this sets it after working on it, and the    *
+     * consumer only picks packets after seeing it set.                     */
+    template < typename F >
+    unsigned int process(F & fun)
+    {
+        /* one snapshot of both indexes: the walk never passes the writer */
+        unsigned int first = 0;
+
+        const unsigned int total = _audio->snapshot(first);
+
+        if (!total)
+            return 0;
+
+        const unsigned int mask = _audio->slots() - 1;
+
+        unsigned int amount = 0;
+
+        for (unsigned int i = 0; i < total; i++)
+        {
+            const unsigned int index = (first + i) & mask;
+
+            SlotInfo & info = slot_info()[index];
+
+            if (Atomic::doLoad(&info.processed))
+                continue;
+
+            Packet & p = ((Packet *)audio_buffer())[index];
+
+            if (_vad)
+                info.silent = classify(&p);
+
+            fun((char *)&p, FrameStorage::packet_size());
+
+            /* the consumer may pick it from now on */
+            Atomic::doStore(&info.processed, true);
+
+            ++amount;
+        }
+
+        return amount;
+    }
+
+    /* should only be called when buffer is not being used */
+    void packet_size(unsigned int size)
+    {
+        if (size == 0 || size > (unsigned int)S)
+            size = S;
+
+        FrameStorage::packet_size(size);
+
+        clear();
+    }
+
+    unsigned int packet_size(void)
+    {
+        return FrameStorage::packet_size();
+    }
 
-    // may throw Ringbuffer::BufferEmpty
+    /* packet duration in ms (8 bytes per ms, G.711) */
+    unsigned int packet_duration(void)
+    {
+        return FrameStorage::packet_size() / 8;
+    }
+
+    /* Picked frames point straight into the buffer (no copies). The packets   *
+     * stay held inside the buffer until the next pick (or flush), so neither  *
+     * the provider nor its overflow policy can touch them while the frame is  *
+     * still being used: the caller must be done with the previous frame when *
+     * picking again, which is what happens with read_frame and the listener. */
     switch_frame_t * pick(void)
     {
+        release();
+
+        if (!_audio->consumer_hold(1))
+            return NULL;
+
+        Packet & a = _audio->consumer_held();
+
+        SlotInfo & info = slot_info()[&a - (Packet *)audio_buffer()];
+
+        /* not ready yet, the media thread will wake us up: leave it *
+         * in place (releasing would drop it while still being used) */
+        if (!Atomic::doLoad(&info.processed))
+        {
+            _audio->consumer_unhold();
+            return NULL;
+        }
+
+        _stats.delay.add(log2_bucket(now_ms() - info.stamp));
+
+        if (_vad && info.silent)
+        {
+            /* nothing to hold, give it back right away */
+            release();
+
+            ++_stats.suppressed;
+
+            return cng();
+        }
+
+        switch_frame * f = next_frame();
+
+        /* adjust pointer */
+        f->data = (char *)(&a);
+
+        /* frames may have been used by pick(max) */
+        f->datalen = FrameStorage::packet_size();
+        f->samples = FrameStorage::packet_size();
+
+        stamp(f);
+
+        return f;
+    }
+
+    /* picks up to 'max' packets at once, as long as they are contiguous in *
+     * memory (only when packets fill the whole slot, otherwise picks one). */
+    switch_frame_t * pick(unsigned int max)
+    {
+        const unsigned int packet = FrameStorage::packet_size();
+
+        if (packet != (unsigned int)S)
+            max = 1;
+
+        release();
+
+        const unsigned int amount = _audio->consumer_hold(max);
+
+        if (!amount)
+            return NULL;
+
+        Packet & a = _audio->consumer_held();
+
+        switch_frame * f = next_frame();
+
+        f->data = (char *)(&a);
+
+        _stats.delay.add(log2_bucket(now_ms() - slot_info()[&a - (Packet *)audio_buffer()].stamp));
+
+        f->datalen = amount * packet;
+        f->samples = amount * packet;
+
+        stamp(f);
+
+        return f;
+    }
+
+    /* gives back the packets of the last frame picked */
+    void release(void)
+    {
+        _audio->consumer_release();
+    }
+
+    /* discards every packet waiting to be picked (consumer side only); *
+     * in batched mode, stops at the first one not processed yet, which *
+     * the media thread may still be working on.                        */
+    unsigned int flush(void)
+    {
+        unsigned int amount = 0;
+
+        release();
+
         try
         {
-            /* try to consume from buffer.. */
-            Packet & a = _audio.consumer_start();
+            while (true)
+            {
+                Packet & p = _audio->consumer_start();
 
-            switch_frame * f = next_frame();
+                if (_batched && !Atomic::doLoad(&(slot_info()[&p - (Packet *)audio_buffer()].processed)))
+                    break;
 
-            /* adjust pointer */
-            f->data = (char *)(&a);
+                _audio->consumer_commit();
 
-            /* advance now */
-            _audio.consumer_commit();
- 
-            return f;
+                ++amount;
+            }
         }
         catch (...) // AudioBuffer::BufferEmpty & e)
         {
-            return NULL;
         }
+
+        _stats.flushed += amount;
+
+        return amount;
     }
 
-    // may throw Ringbuffer::BufferFull
     bool give(const char * buf, unsigned int size)
     {
-        return _audio.provider_partial(buf, size);
+        bool complete;
+        return give(buf, size, complete);
+    }
+
+    /* returns false if some data could not be stored, and *
+     * sets 'complete' if some packet has been completed.  */
+    bool give(const char * buf, unsigned int size, bool & complete)
+    {
+        const unsigned int packet = FrameStorage::packet_size();
+
+        complete = false;
+
+        while (size != 0)
+        {
+            Packet * p = provider_start(buf, size);
+
+            /* buffer full, the rest was discarded */
+            if (!p)
+                return false;
+
+            unsigned int amount = std::min(size, packet - _fill);
+
+            memcpy((void *)&((*p)[_fill]), (const void *)buf, amount);
+
+            _fill += amount;
+
+            buf   += amount;
+            size  -= amount;
+
+            if (_fill == packet)
+            {
+                SlotInfo & info = slot_info()[p - (Packet *)audio_buffer()];
+
+                info.stamp = now_ms();
+
+                if (_vad && !_batched)
+                    info.silent = classify(p);
+
+                /* must be written before the packet is visible */
+                Atomic::doStore(&info.processed, !_batched);
+
+                _audio->provider_commit();
+
+                _stats.occupancy.add(count());
+
+                _fill    = 0;
+                complete = true;
+            }
+        }
+
+        return true;
     }
 
     switch_frame_t * cng(void)
     {
-        return cng_frame();
+        switch_frame_t * f = cng_frame();
+
+        /* keep the clock running while sending silence */
+        stamp(f);
+
+        return f;
     }
 
     void clear()
     {
-        _audio.clear();
+        _audio->clear();
+        _fill = 0;
+        _hang = _hangover;
+
+        restart();
     }
 
  protected:
-    AudioBuffer      _audio;
+    /* true if a complete packet should be suppressed; speech restarts the hangover */
+    bool classify(Packet * p)
+    {
+        bool quiet = silent(*p, FrameStorage::packet_size());
 
-    unsigned int     _index;
+        if (!quiet)
+            _hang = _hangover;
+        else if (_hang != 0)
+        {
+            --_hang;
+            quiet = false;
+        }
+
+        return quiet;
+    }
+
+    /* returns the packet being filled, or NULL if the policy says *
+     * the incoming data (in 'buf') should be discarded.           */
+    Packet * provider_start(const char * buf, unsigned int size)
+    {
+        try
+        {
+            return &(_audio->provider_start());
+        }
+        catch (...) // AudioBuffer::BufferFull & e)
+        {
+            ++_stats.overflows;
+        }
+
+        switch (_policy)
+        {
+            case BP_DROP_NEWEST:
+                ++_stats.dropped;
+                return NULL;
+
+            case BP_COMPRESS_SILENCE:
+                if (silent(buf, size))
+                {
+                    ++_stats.silenced;
+                    return NULL;
+                }
+                break;
+
+            case BP_DROP_OLDEST:
+                break;
+        }
+
+        /* the media thread may be working on the oldest packet */
+        SlotInfo & oldest = slot_info()[&(_audio->consumer_held()) - (Packet *)audio_buffer()];
+
+        if (_batched && !Atomic::doLoad(&oldest.processed))
+        {
+            ++_stats.dropped;
+            return NULL;
+        }
+
+        /* if the consumer got there first, there is room anyway; if the *
+         * oldest packet is held by the consumer, the newest is dropped. */
+        if (_audio->provider_discard())
+            ++_stats.dropped;
+
+        try
+        {
+            return &(_audio->provider_start());
+        }
+        catch (...) // AudioBuffer::BufferFull & e)
+        {
+            ++_stats.dropped;
+            return NULL;
+        }
+    }
+
+ protected:
+    AudioBuffer    * _audio;
+
+    PolicyType       _policy;
+    Stats            _stats;
+
+    /* bytes already written into the packet being filled */
+    unsigned int     _fill;
+
+    /* silence suppression (see 'vad') */
+    bool             _vad;
+    unsigned int     _hangover;
+    unsigned int     _hang;
+
+    /* per-packet work done by a media thread (see 'batched') */
+    bool             _batched;
 };
 
-typedef FrameManager < Globals::switch_packet_size > FrameSwitchManager;
+typedef FrameManager < Globals::switch_packet_max_size > FrameSwitchManager;
 typedef FrameManager < Globals::boards_packet_size > FrameBoardsManager;
 
 #endif /* _FRAME_HPP_ */
@@ -0,0 +1,145 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#ifndef _G711_H_
+#define _G711_H_
+
+#include <stdint.h>
+
+/* A-law <-> 16-bit linear conversion, used when channels run in linear     *
+ * (L16) mode so freeswitch does not need to transcode every frame.         *
+ *                                                                          *
+ * Both directions are table driven: decoding uses a 256-entry table, and  *
+ * encoding uses a 8192-entry table indexed by the 13 significant bits of   *
+ * the sample. On CPUs with AVX2 (checked at runtime by 'initialize'),      *
+ * decoding gathers 8 samples at a time from the same table, and encoding   *
+ * computes 16 codes at a time. Tables must be built by 'initialize' before *
+ * any conversion.                                                          *
+ *                                                                          *
+ * Gain is also applied through tables (A-law to A-law, one for each step   *
+ * from gain_min to gain_max, 'gain_step_db' apart), so adjusting volume    *
+ * costs a single lookup per sample, without any arithmetic.                *
+ *                                                                          *
+ * The same goes for u-law (PCMU) channels: A-law <-> u-law is a 256-entry  *
+ * table in each direction, applied just like gain.                         */
+struct G711
+{
+    static const int gain_min = -10;
+    static const int gain_max =  10;
+
+    static const double gain_step_db;
+
+    static void initialize(void);
+
+    /* table for a given gain step, or NULL if step is zero (no gain) */
+    static inline const unsigned char * gain(int step)
+    {
+        if (step == 0)
+            return NULL;
+
+        step = (step < gain_min ? gain_min : (step > gain_max ? gain_max : step));
+
+        return _gain[step - gain_min];
+    }
+
+    /* applies a gain table over 'count' A-law samples ('in' may be 'out') */
+    static void apply(const unsigned char * table, const char * in, char * out, unsigned int count);
+
+    /* converts 'count' samples from 'in' to 'out' */
+    static inline void alaw_to_linear(const char * in, int16_t * out, unsigned int count)
+    {
+        _to_linear(in, out, count);
+    }
+
+    static inline void linear_to_alaw(const int16_t * in, char * out, unsigned int count)
+    {
+        _to_alaw(in, out, count);
+    }
+
+    /* true if the AVX2 conversions are in use */
+    static bool vectorized(void);
+
+    /* implementations picked by 'initialize' (the AVX2 ones on x86 only) */
+    static void alaw_to_linear_table(const char * in, int16_t * out, unsigned int count);
+    static void linear_to_alaw_table(const int16_t * in, char * out, unsigned int count);
+
+    static void alaw_to_linear_avx2(const char * in, int16_t * out, unsigned int count);
+    static void linear_to_alaw_avx2(const int16_t * in, char * out, unsigned int count);
+
+    static inline void alaw_to_ulaw(const char * in, char * out, unsigned int count)
+    {
+        apply(_alaw_ulaw, in, out, count);
+    }
+
+    static inline void ulaw_to_alaw(const char * in, char * out, unsigned int count)
+    {
+        apply(_ulaw_alaw, in, out, count);
+    }
+
+    static inline int16_t decode(unsigned char alaw)
+    {
+        return (int16_t)_decode[alaw];
+    }
+
+    static inline char encode(int16_t linear)
+    {
+        return _encode[((uint16_t)linear) >> 3];
+    }
+
+ protected:
+    typedef void (*ToLinearType)(const char *, int16_t *, unsigned int);
+    typedef void (*ToAlawType)(const int16_t *, char *, unsigned int);
+
+    static ToLinearType  _to_linear;
+    static ToAlawType    _to_alaw;
+
+    static int32_t       _decode[256];  /* int32 so AVX2 can gather from it */
+    static unsigned char _encode[8192];
+
+    static unsigned char _gain[gain_max - gain_min + 1][256];
+
+    static unsigned char _alaw_ulaw[256];
+    static unsigned char _ulaw_alaw[256];
+};
+
+#endif /* _G711_H_ */
@@ -65,9 +65,11 @@ extern "C"
 struct Globals
 {
     static const unsigned int switch_packet_duration  =                          30; // in ms
+    static const unsigned int switch_packet_max_duration =                       60; // in ms
     static const unsigned int boards_packet_duration  =                          16; // in ms
 
     static const unsigned int switch_packet_size      = switch_packet_duration *  8; // in bytes
+    static const unsigned int switch_packet_max_size  = switch_packet_max_duration * 8; // in bytes
     static const unsigned int boards_packet_size      = boards_packet_duration *  8; // in bytes
 
     static const unsigned int    cng_buffer_size      =          boards_packet_size; // in bytes
@@ -44,9 +44,16 @@
 #ifndef _KHOMP_PVT_H_
 #define _KHOMP_PVT_H_
 
+#include <atomic.hpp>
+
 #include "globals.h"
 #include "mod_khomp.h"
 #include "frame.h"
+#include "channel_table.h"
+#include "playout.h"
+#include "plc.h"
+#include "g711.h"
+#include "recorder.h"
 #include "utils.h"
 #include "opt.h"
 #include "logger.h"
@@ -261,6 +268,95 @@ struct KhompPvt
 
     struct InitFailure {};
 
+    /* counters for the blocking reader, see channel_read_frame */
+    struct ReaderStats
+    {
+        ReaderStats() { clear(); }
+
+        void clear()
+        {
+            frames    = 0;
+            wakeups   = 0;
+            timeouts  = 0;
+            concealed = 0;
+        }
+
+        unsigned long frames;    /*!< frames returned with real audio */
+        unsigned long wakeups;   /*!< times the reader woke up from wait */
+        unsigned long timeouts;  /*!< waits that ended without audio */
+        unsigned long concealed; /*!< timeouts answered with concealed audio */
+    };
+
+public:
+    /* audio path summary, for the console and channel variables */
+    struct AudioStats
+    {
+        AudioStats() { clear(); }
+
+        void clear()
+        {
+            calls        = 0;
+            rx_frames    = 0;
+            rx_cng       = 0;
+            rx_overflows = 0;
+            rx_dropped   = 0;
+            rx_concealed = 0;
+            tx_underruns = 0;
+            tx_overflows = 0;
+            tx_dropped   = 0;
+            tx_inserted  = 0;
+            tx_deleted   = 0;
+            stalls       = 0;
+            stall_ms     = 0;
+
+            rx_occupancy.clear();
+            tx_occupancy.clear();
+            rx_delay.clear();
+            tx_delay.clear();
+        }
+
+        void add(const AudioStats & o)
+        {
+            calls        += o.calls;
+            rx_frames    += o.rx_frames;
+            rx_cng       += o.rx_cng;
+            rx_overflows += o.rx_overflows;
+            rx_dropped   += o.rx_dropped;
+            rx_concealed += o.rx_concealed;
+            tx_underruns += o.tx_underruns;
+            tx_overflows += o.tx_overflows;
+            tx_dropped   += o.tx_dropped;
+            tx_inserted  += o.tx_inserted;
+            tx_deleted   += o.tx_deleted;
+            stalls       += o.stalls;
+            stall_ms     += o.stall_ms;
+
+            rx_occupancy.add(o.rx_occupancy);
+            tx_occupancy.add(o.tx_occupancy);
+            rx_delay.add(o.rx_delay);
+            tx_delay.add(o.tx_delay);
+        }
+
+        unsigned long calls;
+        unsigned long rx_frames;    /*!< frames with audio given to freeswitch */
+        unsigned long rx_cng;       /*!< CNG frames given instead of audio */
+        unsigned long rx_overflows;
+        unsigned long rx_dropped;
+        unsigned long rx_concealed; /*!< frames synthesized on reader underruns */
+        unsigned long tx_underruns; /*!< board ticks without audio to send */
+        unsigned long tx_overflows;
+        unsigned long tx_dropped;
+        unsigned long tx_inserted;  /*!< samples inserted to compensate clock drift */
+        unsigned long tx_deleted;   /*!< samples deleted to compensate clock drift */
+        unsigned long stalls;       /*!< audio listener stalls, see Supervisor */
+        unsigned long stall_ms;     /*!< time without audio due to stalls */
+
+        FrameStorage::OccupancyHistogram rx_occupancy;
+        FrameStorage::OccupancyHistogram tx_occupancy;
+        FrameStorage::DelayHistogram     rx_delay;     /*!< listener to channel_read_frame */
+        FrameStorage::DelayHistogram     tx_delay;     /*!< channel_write_frame to stream */
+    };
+
 public:
 
     KhompPvt(K3LAPI::target & target);
@@ -407,48 +503,35 @@ public:
     bool command(const char *file, const char *func, int line, int code,
             const char *params = NULL)
     {
-        try
-        {
-            Globals::k3lapi.command(_target, code, params);
-        }
-        catch(K3LAPI::failed_command & e)
-        {
-            K::Logger::Logg(C_ERROR,OBJ_FMT(e.dev,e.obj,"Command '%s' has failed with error '%s'")
-               % Verbose::commandName(e.code).c_str()
-               % Verbose::status((KLibraryStatus)e.rc).c_str());
-
-            return false;
-        }
-
-        return true;
+        return (commandState(file, func, line, code, params) == ksSuccess);
     }
-    
-    //TODO: Unir os dois metodos
+
     int commandState(const char *file, const char *func, int line, int code,
             const char *params = NULL)
     {
-        try
-        {
-            Globals::k3lapi.command(_target, code, params);
-        }
-        catch(K3LAPI::failed_command & e)
-        {
-            K::Logger::Logg(C_ERROR,OBJ_FMT(e.dev,e.obj,"Command '%s' has failed with error '%s'")
-               % Verbose::commandName(e.code).c_str()
-               % Verbose::status((KLibraryStatus)e.rc).c_str());
+        /* no exceptions here, this is used from the audio callback */
+        int32 rc = Globals::k3lapi.command_status(_target, code, params);
 
-            return e.rc;
+        if (rc != ksSuccess)
+        {
+            K::Logger::Logg(C_ERROR,OBJ_FMT(_target.device,_target.object,"Command '%s' has failed with error '%s'")
+               % Verbose::commandName(code).c_str()
+               % Verbose::status((KLibraryStatus)rc).c_str());
         }
 
-        return ksSuccess;
+        return rc;
     }
 
-
     /*!
      \brief Will init part of our private structure and setup all the read/write
      buffers along with the proper codecs. Right now, only PCMA.
     */
-    switch_status_t justAlloc(bool is_answering = true, switch_memory_pool_t **pool = NULL);
+    switch_status_t justAlloc(bool is_answering = true, switch_memory_pool_t **pool = NULL,
+            switch_core_session_t * peer = NULL);
+
+    /* codec for a new session: the one of 'peer' (if any) when it is   *
+     * converted here (PCMA, PCMU or L16), or else the configured one.  */
+    static const char * sessionCodec(switch_core_session_t * peer);
     switch_status_t justStart(switch_caller_profile_t *profile = NULL);
 
     void SignalState(int state);
@@ -504,12 +587,127 @@ public:
         }
     }
 
+    /* should only be called when audio is not flowing */
+    void setupAudioBuffers(unsigned int length, FrameStorage::PolicyType policy);
+
+    /* adds the current call audio stats to 's' */
+    void audioStats(AudioStats & s);
+
+    /* stats of all finished calls on this channel */
+    AudioStats & audioTotals(void) { return _audio_totals; }
+
+    /* exports the current call audio stats as channel variables */
+    void setAudioVariables(switch_channel_t * channel);
+
+    /* reloads gains from channel variables "KInputVolume" and "KOutputVolume" */
+    void updateVolumes(void);
+
+    /* variables are locked, so both audio paths only reload them once *
+     * a second: whichever gets there first does it.                    */
+    void refreshVolumes(void)
+    {
+        const uint32_t now  = FrameStorage::now_ms();
+        uint32_t       last = _volume_stamp;
+
+        if (now - last < 1000 || !Atomic::doCAS(&_volume_stamp, &last, now))
+            return;
+
+        updateVolumes();
+    }
+
+    /* gain tables to be used now (NULL means no gain) */
+    const unsigned char * inputGain(void)  { return G711::gain(_input_volume);  }
+    const unsigned char * outputGain(void) { return G711::gain(_output_volume); }
+
+    /* converts a frame picked from the reader buffer to linear (L16) */
+    switch_frame_t * linearFrame(switch_frame_t * f)
+    {
+        G711::alaw_to_linear((const char *)f->data, _linear_buffer, f->datalen);
+
+        _linear_frame = *f;
+
+        _linear_frame.data    = (void *)_linear_buffer;
+        _linear_frame.datalen = f->datalen * sizeof(int16_t);
+        _linear_frame.buflen  = sizeof(_linear_buffer);
+
+        return &_linear_frame;
+    }
+
+    /* synthetic frame for a reader underrun, NULL if it can't be concealed */
+    switch_frame_t * concealFrame(void)
+    {
+        const unsigned int size = _reader_frames.packet_size();
+
+        if (!_reader_plc.conceal(_conceal_buffer, size))
+            return NULL;
+
+        _conceal_frame = *(_reader_frames.cng());
+
+        _conceal_frame.data    = (void *)_conceal_buffer;
+        _conceal_frame.datalen = size;
+        _conceal_frame.samples = size;
+        _conceal_frame.buflen  = sizeof(_conceal_buffer);
+        _conceal_frame.flags   = SFF_PLC;
+
+        return &_conceal_frame;
+    }
+
+    /* with "lazy-audio", these only mark listen/stream as wanted; they are *
+     * started by the first frame freeswitch reads or writes (see below).   */
     bool start_stream(void);
     bool stop_stream(void);
 
     bool start_listen(bool conn_rx = true);
     bool stop_listen(void);
 
+    /* called for every frame read/written by freeswitch */
+    void media_read(void)
+    {
+        _media_read_stamp = FrameStorage::now_ms();
+
+        if (call()->_flags.check(Kflags::LAZY_LISTEN))
+            wake_audio(false);
+    }
+
+    void media_write(void)
+    {
+        _media_write_stamp = FrameStorage::now_ms();
+
+        if (call()->_flags.check(Kflags::LAZY_STREAM))
+            wake_audio(true);
+    }
+
+    /* stops listen/stream not used by freeswitch for 'timeout' ms, *
+     * keeping them wanted (from the supervisor thread).            */
+    void idle_audio(uint32_t now, uint32_t timeout);
+
+    /* start listen/stream on the board, right now */
+    bool arm_listen(bool conn_rx);
+    bool arm_stream(void);
+
+    /* starts what is wanted, after being lazy or idle */
+    void wake_audio(bool writing);
+
+    /* restarts listen and stream on the board, if they are up */
+    bool rearm_audio(void);
+
+    /* cross-connects this channel with 'peer' (same board) in the mixer, *
+     * stopping host audio (true if already bridged with it, false if    *
+     * with another one); unbridge restores listen and stream, if they   *
+     * were (or were asked to be) started in between, and asks the peer  *
+     * to unbridge as well (see NATIVE_UNBRIDGE).                         */
+    bool native_bridge(KhompPvt * peer);
+    bool native_unbridge(void);
+
+    /* host audio is needed by media bugs and recording, so a native bridge *
+     * is refused while they are attached; adding them removes the bridge, *
+     * on both legs (see NATIVE_UNBRIDGE).                                  */
+    bool native_bridge_allowed(void);
+
+    /* recording of both directions, see RecordTap */
+    bool startRecording(void);
+    void stopRecording(void);
+
     bool obtainRX(bool with_delay = false);
 
     bool send_dtmf(char digit);
@@ -533,6 +731,49 @@ public:
     FrameSwitchManager _reader_frames;
     FrameBoardsManager _writer_frames;
 
+    SavedCondition     _reader_cond;  /*!< Signaled when a full packet is read */
+    unsigned int       _media_slice;  /*!< media thread processing it, see MediaTick */
+    ReaderStats        _reader_stats;
+
+    Playout            _writer_playout; /*!< Controls writer buffer depth */
+    Concealer          _reader_plc;     /*!< Fills reader underruns */
+
+    AudioStats         _audio_totals;
+
+    RecordTap          _record_tap;
+
+    /* audio listener supervision, see Supervisor */
+    volatile uint32_t  _listen_stamp;  /*!< when the listener last delivered audio (ms) */
+    volatile bool      _reader_flush;  /*!< reader should discard buffered audio */
+    volatile bool      _writer_flush;  /*!< listener should discard buffered audio */
+    bool               _stalled;
+    uint32_t           _stall_since;   /*!< last packet before the stall */
+    uint32_t           _stall_rearm;   /*!< last time audio was re-armed */
+    unsigned long      _stalls;
+    unsigned long      _stall_ms;
+
+    /* lazy audio activation, see media_read/media_write */
+    volatile uint32_t  _media_read_stamp;  /*!< last frame read by freeswitch (ms) */
+    volatile uint32_t  _media_write_stamp; /*!< last frame written by freeswitch (ms) */
+    bool               _lazy_conn_rx;      /*!< mixer record still to be set on listen */
+    unsigned long      _audio_wakes;
+    unsigned long      _audio_idles;
+
+    int                _bridge_peer;       /*!< object natively bridged with, or -1 */
+
+    /* gain steps, read by the audio path without locking */
+    volatile int       _input_volume;
+    volatile int       _output_volume;
+    volatile uint32_t  _volume_stamp; /*!< when volumes were reloaded (ms) */
+
+    /* reader frame, when running in linear mode */
+    switch_frame_t     _linear_frame;
+    int16_t            _linear_buffer[Globals::switch_packet_max_size];
+
+    /* reader frame, when concealing an underrun */
+    switch_frame_t     _conceal_frame;
+    char               _conceal_buffer[Globals::switch_packet_max_size];
+
 };
 
 /******************************************************************************/
@@ -575,6 +816,7 @@ public:
     ChanCommandHandler * chanCommandHandler() { return _command_handler; }
 
     void initializeChannels(void);
+    void initializeAudioBuffers(void);
     void finalizeChannels(void);
 
     virtual int eventHandler(const int obj, K3L_EVENT *e)
@@ -588,11 +830,10 @@ public:
         case EV_REQUEST_DEVICE_SECURITY_KEY:
             break;
         default:
-            try
-            {
-                ret = channel(obj)->eventHandler(e);
-            }
-            catch (K3LAPI::invalid_channel & invalid)
+        {
+            KhompPvt * pvt = lookup(_device_id, obj);
+
+            if (!pvt)
             {
                 K::Logger::Logg(C_ERROR, OBJ_FMT(_device_id,obj,"r (invalid channel on event '%s'.)") 
                 % Verbose::eventName(e->Code).c_str());
@@ -600,8 +841,10 @@ public:
                 return ksFail;
             }
 
+            ret = pvt->eventHandler(e);
             break;
         }
+        }
         
         DBG(FUNC, D("(Generic Board) r"));
         return ret;
@@ -622,7 +865,10 @@ public:
     static bool finalizeHandlers(void);
     static void initializeBoards(void);
     static void finalizeBoards(void);
+    static void initializeTable(void);
+    static void finalizeTable(void);
     static void initializeCngBuffer(void);
+    static void initializeArena(void);
     static bool initialize(void);
     static bool finalize(void);
 
@@ -686,6 +932,20 @@ public:
         }
     }
 
+    /* exception-free versions of the above, for the audio and event paths */
+    static Board * lookupBoard(unsigned int device)
+    {
+        if (device >= _boards.size())
+            return NULL;
+
+        return _boards[device];
+    }
+
+    static KhompPvt * lookup(unsigned int device, unsigned int object)
+    {
+        return _pvt_table.lookup(device, object);
+    }
+
     static unsigned int getStats(int32 device, int32 object, uint32 index)
     {
         unsigned int stats = (unsigned int)-1;
@@ -715,6 +975,13 @@ public:
     static switch_mutex_t *_pvts_mutex;
     static char            _cng_buffer[Globals::cng_buffer_size];
 
+    /* see lookup() */
+    static ChannelTable < KhompPvt > _pvt_table;
+
+    /* CM_ADD_STREAM_BUFFER counters, see 'khomp show commands' */
+    static volatile unsigned long _stream_commands;
+    static volatile unsigned long _stream_packets;
+
 };
 
 #endif /* _KHOMP_PVT_H_*/
@@ -0,0 +1,106 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+
+#ifndef _MEDIA_H_
+#define _MEDIA_H_
+
+#include <vector>
+
+#include <saved_condition.hpp>
+#include <thread.hpp>
+
+#include "khomp_pvt.h"
+
+/* Batched media tick (optional, see "media-threads").                       *
+ *                                                                           *
+ * Instead of doing per-packet work on the K3L audio callback and on each    *
+ * session thread, the channels are split in contiguous slices, each owned   *
+ * by a media thread (pinned to a cpu, when possible). The first packet      *
+ * completed on a slice since its last tick wakes its thread up (see         *
+ * 'arrived'), which walks the slice in memory order (which is also the      *
+ * order of the audio arena), runs silence classification and input gain    *
+ * over the reader packets received meanwhile, and only then wakes up the    *
+ * session threads waiting for them. So a packet waits one thread wake-up,   *
+ * plus the tick itself, before being picked: the worst wait is kept in the  *
+ * slice stats, and the packet delay histograms include it.                  */
+struct MediaTick
+{
+    static bool initialize(void);
+    static void finalize(void);
+
+    static bool enabled(void) { return !_slices.empty(); }
+
+    /* from the audio listener, when 'pvt' has completed a reader packet */
+    static void arrived(Board::KhompPvt * pvt);
+
+ protected:
+    struct Slice
+    {
+        Slice(unsigned int index);
+        ~Slice();
+
+        unsigned int                       _index;
+        std::vector < Board::KhompPvt * >  _pvts;
+
+        SavedCondition                     _cond;
+        Thread                           * _thread;
+
+        volatile uint32_t                  _pending;  /*!< first arrival since the last tick (ms), or 0 */
+
+        unsigned long                      _ticks;
+        unsigned long                      _idle;     /*!< ticks without arrivals (fallback period) */
+        uint32_t                           _wait_max; /*!< longest from an arrival to its tick (ms) */
+    };
+
+    static int worker(Slice *);
+
+    static void tick(Slice &);
+
+    typedef std::vector < Slice * > SliceVector;
+
+    static SliceVector   _slices;
+    static volatile bool _shutdown;
+};
+
+#endif /* _MEDIA_H_ */
@@ -76,7 +76,8 @@ typedef enum
     TFLAG_CODEC = (1 << 7),
     TFLAG_BREAK = (1 << 8),
     TFLAG_STREAM = (1 << 9),
-    TFLAG_LISTEN = (1 << 10)
+    TFLAG_LISTEN = (1 << 10),
+    TFLAG_ULAW = (1 << 11)
 }
 TFLAGS;
 
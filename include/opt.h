@@ -68,9 +68,17 @@ struct CadenceType
 };
 
 struct CSpan {
+    CSpan() : _audio_buffer_length(0) {};
+
     std::string _dialplan;
     std::string _context;
     std::string _dialstring;
+
+    /* channels (allocation string) the audio settings below apply to */
+    std::string  _channels;
+
+    unsigned int _audio_buffer_length; /* 0 means "use global" */
+    std::string  _audio_buffer_policy; /* empty means "use global" */
 };
 
 struct Opt
@@ -193,6 +201,36 @@ public:
 
     static unsigned int _audio_packet_size;
 
+    static unsigned int _audio_buffer_length;
+    static std::string  _audio_buffer_policy;
+
+    static bool         _adaptive_playout;
+    static bool         _drift_compensation;
+    static unsigned int _reader_concealment;
+    static unsigned int _stream_buffer_packets;
+
+    static bool         _audio_memory_lock;
+    static bool         _audio_memory_hugepages;
+
+    static bool         _suppress_silence;
+    static unsigned int _silence_hangover;
+
+    static bool         _linear_audio;
+    static bool         _ulaw_audio;
+    static bool         _match_peer_codec;
+
+    static std::string  _record_format;
+
+    static unsigned int _audio_stall_timeout;
+
+    static unsigned int _media_threads;
+
+    static bool         _lazy_audio;
+    static unsigned int _audio_idle_timeout;
+
+    static std::string  _shm_export;
+    static unsigned int _shm_export_slots;
+
 protected:
 
     struct ProcessFXSCODialtone
@@ -0,0 +1,159 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#ifndef _PLAYOUT_H_
+#define _PLAYOUT_H_
+
+#include "globals.h"
+
+#include <atomic.hpp>
+
+/* Adaptive playout control for the writer (freeswitch -> board) buffer.     *
+ *                                                                           *
+ * The provider side reports every packet arrival, which is used to keep an  *
+ * estimate of the arrival jitter (RFC 3550 style). From that, a target      *
+ * depth (in board packets) is derived. The consumer side asks what to do on *
+ * every board tick: wait until the target depth is reached (after starting  *
+ * or after an underrun), play, or shrink the buffer discarding silence.     *
+ *                                                                           *
+ * Besides that, the provider (freeswitch timers) and the consumer (board,   *
+ * locked to the line clock) run on different clocks, so the depth slowly    *
+ * creeps up or down on long calls. A smoothed depth is compared against the *
+ * depth reached once playing settles, and single samples are inserted or    *
+ * deleted in quiet spots of outgoing packets ('stretch') to cancel drift.   *
+ *                                                                           *
+ * The jitter estimate is owned by the provider thread; only its results     *
+ * (_jitter and _target) are published to the consumer, with release/acquire *
+ * atomics. Everything else is owned by the consumer thread.                 */
+struct Playout
+{
+    typedef enum
+    {
+        PO_WAIT,   /* not enough audio buffered, send nothing */
+        PO_PLAY,   /* play the next packet */
+        PO_SHRINK, /* too much audio buffered, may skip silence */
+    }
+    ActionType;
+
+    struct Stats
+    {
+        Stats() { clear(); }
+
+        void clear()
+        {
+            underruns   = 0;
+            shrinks     = 0;
+            depth_sum   = 0;
+            depth_ticks = 0;
+            depth_max   = 0;
+            inserted    = 0;
+            deleted     = 0;
+        }
+
+        unsigned long underruns;   /*!< buffer emptied while playing */
+        unsigned long shrinks;     /*!< silent packets skipped */
+        unsigned long depth_sum;   /*!< sum of depths seen on each tick */
+        unsigned long depth_ticks; /*!< ticks seen */
+        unsigned int  depth_max;   /*!< max depth seen on a tick */
+        unsigned long inserted;    /*!< samples inserted by drift compensation */
+        unsigned long deleted;     /*!< samples deleted by drift compensation */
+    };
+
+    Playout(): _enabled(true), _compensate(true) { reset(); };
+
+    void reset(void);
+
+    void enabled(bool e) { _enabled = e; }
+    bool enabled(void)   { return _enabled; }
+
+    void compensate(bool c) { _compensate = c; }
+
+    /* provider side: a packet of 'duration' ms has been written */
+    void arrival(unsigned int duration);
+
+    /* consumer side: 'depth' packets buffered, from a 'capacity' total */
+    ActionType tick(unsigned int depth, unsigned int capacity);
+
+    /* consumer side: buffer was found empty, or a silent packet was skipped */
+    void underrun(void) { ++_stats.underruns; _buffering = true; _depth_ref = -1; }
+    void shrunk(void)   { ++_stats.shrinks; }
+
+    /* consumer side: samples to insert (> 0) or delete (< 0) on the next packet */
+    int correction(void) { return _pending; }
+
+    /* consumer side: the correction was applied to a packet */
+    void corrected(void);
+
+    /* copies 'size' A-law samples from 'in' to 'out' inserting (delta > 0) *
+     * or deleting (delta < 0) one sample at the quietest spot, returning   *
+     * the new size, or 0 if there is no spot quiet enough in this packet.  *
+     * 'out' must have room for 'size + 1' samples.                         */
+    static unsigned int stretch(const char * in, unsigned int size, char * out, int delta);
+
+    unsigned int target(void) { return Atomic::doLoad(&_target); }
+    unsigned int jitter(void) { return Atomic::doLoad(&_jitter) / 1000; } /* in ms */
+
+    Stats & stats(void) { return _stats; }
+
+ protected:
+    bool           _enabled;
+    bool           _buffering;
+
+    /* provider side */
+    switch_time_t  _last;      /* last arrival time (us) */
+    unsigned int   _estimate;  /* jitter estimate (us) */
+
+    /* published by the provider */
+    volatile unsigned int _jitter; /* jitter estimate (us) */
+    volatile unsigned int _target; /* target depth (packets) */
+
+    bool           _compensate;
+    int            _depth_avg;  /* smoothed depth (packets, fixed point) */
+    int            _depth_ref;  /* depth to keep, or -1 if not settled yet */
+    unsigned int   _settle;     /* ticks playing since (re)starting */
+    int            _pending;    /* correction waiting for a quiet packet */
+
+    Stats          _stats;
+};
+
+#endif /* _PLAYOUT_H_ */
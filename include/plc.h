@@ -0,0 +1,106 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+
+#ifndef _PLC_H_
+#define _PLC_H_
+
+#include <stdint.h>
+
+/* Packet loss concealment for the reader, in the style of G.711 Appendix I. *
+ *                                                                           *
+ * Every packet given to freeswitch is kept in a short history. When the     *
+ * reader has nothing to give, the pitch period of the history is found      *
+ * (AMDF over the last 20ms), and the last period is repeated (smoothed into *
+ * the real signal with a quarter-period overlap-add), at full level for the *
+ * first 10ms and then fading out linearly until the concealment limit.      *
+ * When audio comes back, the first quarter period of the real packet is     *
+ * overlap-added with the synthetic signal, so there are no clicks.          */
+struct Concealer
+{
+    static const unsigned int lag_min     = 40;   /* 200 Hz */
+    static const unsigned int lag_max     = 120;  /* 66 Hz */
+    static const unsigned int correlation = 160;  /* 20ms */
+    static const unsigned int history_len = correlation + lag_max;
+
+    /* samples at full level before fading out (10ms) */
+    static const unsigned int full_len    = 80;
+
+    Concealer() : _limit(0) { reset(); }
+
+    /* concealing up to 'ms' ms per gap (0 disables it, at least 10ms) */
+    void limit(unsigned int ms) { _limit = (ms == 0 ? 0 : (ms * 8 > full_len ? ms * 8 : full_len)); }
+
+    bool enabled(void) { return _limit != 0; }
+
+    /* forgets all history (new call, silence suppressed, ...) */
+    void reset(void);
+
+    /* a real A-law packet is being given; its beginning may be smoothed *
+     * (in place) if it comes right after concealed audio.               */
+    void good(char * alaw, unsigned int count);
+
+    /* fills 'alaw' with 'count' concealed samples; returns false when *
+     * there is no history, or when the gap is over the limit.         */
+    bool conceal(char * alaw, unsigned int count);
+
+ protected:
+    void remember(const int16_t * amp, unsigned int count);
+
+    /* level of the synthetic signal after 'missing' samples */
+    float level(unsigned int missing);
+
+    unsigned int find_pitch(void);
+
+    int16_t      _history[history_len];
+    bool         _primed;     /* history has real audio */
+
+    float        _cycle[lag_max];
+    unsigned int _pitch;
+    unsigned int _offset;     /* next sample of _cycle to play */
+
+    unsigned int _missing;    /* samples concealed in the current gap */
+    unsigned int _limit;      /* maximum concealed samples per gap */
+};
+
+#endif /* _PLC_H_ */
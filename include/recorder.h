@@ -0,0 +1,157 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+#include <spsc_ringbuffer.hpp>
+#include <saved_condition.hpp>
+#include <thread.hpp>
+
+#include "globals.h"
+
+/* Per-channel recording tap.                                                *
+ *                                                                           *
+ * The audio listener publishes received (rx) and sent (tx) audio into two   *
+ * single-producer/single-consumer rings; this never blocks nor allocates,   *
+ * and audio is just counted and dropped if the rings are full. The rings    *
+ * are drained by the Recorder thread, which mixes both directions straight *
+ * from the rings (no copies) and writes the result to disk in large blocks */
+struct RecordTap
+{
+    /* 2 seconds of audio on each direction */
+    static const unsigned int ring_size   = 16000;
+
+    /* output is written in multiples of a block */
+    static const unsigned int block_size  = 8192;
+    static const unsigned int block_count = 4;
+
+    RecordTap();
+    ~RecordTap();
+
+    bool active(void) { return _active; }
+
+    /* audio path side */
+    inline void rx(const char * buf, unsigned int size)
+    {
+        if (_active && !_rx->provide(buf, size))
+            ++_overflows;
+    }
+
+    inline void tx(const char * buf, unsigned int size)
+    {
+        if (_active && !_tx->provide(buf, size))
+            ++_overflows;
+    }
+
+    /* nothing sent on this tick: keeps both directions aligned */
+    void tx_silence(unsigned int size);
+
+    std::string & path(void) { return _path; }
+
+    unsigned long overflows(void)     { return _overflows; }
+    unsigned long header_errors(void) { return _header_errors; }
+
+ protected:
+    friend struct Recorder;
+
+    bool allocate(void);
+
+    volatile bool       _active;   /* audio path is feeding the rings */
+    volatile bool       _closing;  /* writer thread should flush and close */
+
+    SpscRingbuffer < char > * _rx;
+    SpscRingbuffer < char > * _tx;
+
+    unsigned long       _overflows;
+    unsigned long       _header_errors; /* WAV header updates that failed */
+
+    /* writer thread side */
+    int                 _fd;
+    bool                _wav;
+    std::string         _path;
+    unsigned long       _written;  /* audio bytes in file */
+
+    char              * _blocks;   /* block_count * block_size, page aligned */
+    unsigned int        _out_fill;
+};
+
+/* Background writer for all recording taps. */
+struct Recorder
+{
+    static bool initialize(void);
+    static void finalize(void);
+
+    /* starts feeding/writing 'tap' to 'path' (raw A-law, or A-law WAV) */
+    static bool start(RecordTap & tap, std::string path, bool wav);
+
+    /* stops feeding 'tap'; the writer thread flushes and closes the file */
+    static void stop(RecordTap & tap);
+
+    /* directory and file name for a new recording of a channel */
+    static std::string filename(unsigned int device, unsigned int object, bool wav);
+
+ protected:
+    static int writer(void *);
+
+    static void drain(RecordTap & tap, bool last);
+    static void output(RecordTap & tap, const char * a, const char * b, unsigned int count);
+    static bool flush(RecordTap & tap, bool last);
+    static void close(RecordTap & tap);
+
+    typedef std::vector < RecordTap * > TapVector;
+
+    static TapVector        _taps;
+    static switch_mutex_t * _mutex;
+
+    static SavedCondition * _cond;
+    static Thread         * _thread;
+    static volatile bool    _shutdown;
+};
+
+#endif /* _RECORDER_H_ */
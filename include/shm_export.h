@@ -0,0 +1,102 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#ifndef _SHM_EXPORT_H_
+#define _SHM_EXPORT_H_
+
+#include <stdint.h>
+
+#include <shm_ringbuffer.hpp>
+
+struct K3L_EVENT;
+
+/* Element exported on the shared-memory ring; this header is also used by *
+ * out-of-process readers (see tools/khomp_shm_reader.cpp), so it should   *
+ * not depend on anything else in the module. Audio is A-law, as received  *
+ * from (rx) or sent to (tx) the board; larger packets take more records.  */
+struct ShmRecord
+{
+    typedef enum
+    {
+        SR_AUDIO_RX = 1,
+        SR_AUDIO_TX = 2,
+        SR_EVENT    = 3,
+    }
+    Type;
+
+    static const unsigned int payload_size = 256;
+
+    uint64_t stamp;     /* microseconds since the epoch */
+    uint16_t type;
+    uint16_t device;
+    uint16_t object;
+    uint16_t size;      /* bytes used in data */
+    int32_t  code;      /* events: K3L event code */
+    int32_t  add_info;  /* events: K3L AddInfo */
+    char     data[payload_size]; /* audio, or event parameters (truncated) */
+};
+
+/* Publishes channel audio and K3L events on the segment named by the      *
+ * "shm-export" option, so analytics, recording or QA tools can consume    *
+ * them without going through freeswitch. Never blocks the audio path: if  *
+ * nobody reads (or the reader is late), records are dropped and counted.  */
+struct ShmExport
+{
+    static bool initialize(void);
+    static void finalize(void);
+
+    static bool enabled(void) { return _enabled; }
+
+    static void audio(ShmRecord::Type type, int device, int object, const char * data, unsigned int size);
+    static void event(int object, K3L_EVENT * ev);
+
+    /* records published and lost since the module was loaded */
+    static unsigned long exported(void);
+    static unsigned long dropped(void);
+
+ protected:
+    static ShmRingbuffer    _ring;
+    static volatile bool    _enabled;
+};
+
+#endif /* _SHM_EXPORT_H_ */
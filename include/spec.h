@@ -91,5 +91,9 @@ Dial(Khomp/B2C58/4832625644)
 
 Board::KhompPvt * process_dial_string (const char *, int *);
 
+/* Calls 'fun' for every channel in the allocation string (same format used *
+ * in dial strings and groups). Returns false if the string is not valid.   */
+bool process_channel_string (std::string, SpecFunType &);
+
 #endif /* _SPEC_HPP_ */
 
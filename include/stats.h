@@ -0,0 +1,107 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/* Fixed-bucket histogram. Each instance has a single writer, so there   *
+ * is no locking; readers (like the console) may see slightly old data. */
+template < unsigned int N >
+struct Histogram
+{
+    static const unsigned int size = N;
+
+    Histogram() { clear(); }
+
+    void clear()
+    {
+        for (unsigned int i = 0; i < N; i++)
+            _buckets[i] = 0;
+    }
+
+    /* values past the last bucket are counted on it */
+    void add(unsigned int bucket)
+    {
+        ++_buckets[(bucket < N ? bucket : N - 1)];
+    }
+
+    void add(const Histogram & o)
+    {
+        for (unsigned int i = 0; i < N; i++)
+            _buckets[i] += o._buckets[i];
+    }
+
+    unsigned long operator[](unsigned int i) const
+    {
+        return _buckets[i];
+    }
+
+    unsigned long total(void) const
+    {
+        unsigned long sum = 0;
+
+        for (unsigned int i = 0; i < N; i++)
+            sum += _buckets[i];
+
+        return sum;
+    }
+
+ protected:
+    volatile unsigned long _buckets[N];
+};
+
+/* bucket on a log2 scale: 0 => 0, 1 => 1, 2-3 => 2, 4-7 => 3, ... */
+inline unsigned int log2_bucket(unsigned int value)
+{
+    unsigned int bucket = 0;
+
+    while (value != 0)
+    {
+        value >>= 1;
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,152 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+
+#ifndef _SUPERVISOR_H_
+#define _SUPERVISOR_H_
+
+#include <vector>
+
+#include <saved_condition.hpp>
+#include <thread.hpp>
+
+#include "khomp_pvt.h"
+
+/* Audio listener stall supervisor.                                          *
+ *                                                                           *
+ * The audio listener stamps each channel when it delivers a packet; this    *
+ * thread compares the stamps of every listening channel against the         *
+ * "audio-stall-timeout" option. A stall is classified by scope: a single    *
+ * channel, a whole board (all listening channels on it) or global (all     *
+ * listening channels on every board). Recovery is coordinated: stale audio  *
+ * is flushed by the side that owns each buffer, listen and stream are       *
+ * re-armed on the board, and, on global stalls, the listener itself is      *
+ * registered again. Each incident is kept with its scope and duration.      *
+ *                                                                           *
+ * With "lazy-audio", the same thread idles listen and stream of channels    *
+ * freeswitch stopped reading/writing for "audio-idle-timeout" ms.           */
+struct Supervisor
+{
+    typedef enum
+    {
+        SC_CHANNEL,
+        SC_BOARD,
+        SC_GLOBAL,
+    }
+    ScopeType;
+
+    struct Incident
+    {
+        ScopeType     scope;
+        unsigned int  device;   /* valid for board and channel scopes */
+        unsigned int  object;   /* valid for channel scope */
+        unsigned int  channels; /* channels found stalled */
+        uint32_t      start;    /* last packet before the stall (ms) */
+        uint32_t      end;      /* first packet after recovery (ms) */
+        unsigned int  rearms;   /* recovery attempts */
+
+        unsigned int duration(void) const { return end - start; }
+    };
+
+    typedef std::vector < Incident > IncidentVector;
+
+    struct Summary
+    {
+        unsigned long  incidents[3]; /* by scope */
+        unsigned long  timeouts;     /* listener timeouts reported by K3L */
+        unsigned long  overflows;    /* listener overflows reported by K3L */
+
+        IncidentVector open;
+        IncidentVector recent;       /* oldest first */
+    };
+
+    typedef std::vector < Board::KhompPvt * > PvtVector;
+
+    static const unsigned int history_size = 16;
+
+    static bool initialize(void);
+    static void finalize(void);
+
+    /* stops supervising (and recovering), before the listener is unregistered */
+    static void stop(void);
+
+    /* from the K3L event callback */
+    static void listenerTimeout(void);
+    static void listenerOverflow(void);
+
+    static void summary(Summary & s);
+
+    static const char * scopeName(ScopeType scope);
+
+ protected:
+    static int supervisor(void *);
+
+    static void check(void);
+    static void idle(void);
+    static void flushAll(void);
+
+    static void open(ScopeType scope, unsigned int device, PvtVector & pvts);
+    static void recover(PvtVector & pvts, bool global);
+    static void recovered(Board::KhompPvt * pvt, uint32_t when);
+    static void close(PvtVector & stalled, uint32_t now);
+
+    static bool contains(const Incident & inc, Board::KhompPvt * pvt);
+    /* true if an open incident of 'scope' or wider already has 'pvt' */
+    static bool covered(Board::KhompPvt * pvt, ScopeType scope);
+
+    static IncidentVector   _open;
+    static IncidentVector   _history;
+
+    static unsigned long    _incidents[3];
+    static volatile unsigned long _timeouts;
+    static volatile unsigned long _overflows;
+
+    static switch_mutex_t * _mutex;
+
+    static SavedCondition * _cond;
+    static Thread         * _thread;
+    static volatile bool    _shutdown;
+    static volatile bool    _overflow;
+};
+
+#endif /* _SUPERVISOR_H_ */
@@ -46,7 +46,7 @@
 
 #include <bitset>
 #include <refcounter.hpp>
-#include <ringbuffer.hpp>
+#include <mpsc_queue.hpp>
 #include <simple_lock.hpp>
 #include <saved_condition.hpp>
 #include <thread.hpp>
@@ -93,7 +93,14 @@ struct Kflags
         PLAY_PBX_TONE,
         PLAY_PUB_TONE,
         PLAY_RINGBACK,
-        PLAY_FASTBUSY
+        PLAY_FASTBUSY,
+
+        NATIVE_BRIDGE,  /* audio goes through the board mixer */
+        BRIDGE_LISTEN,  /* listen to be restored on unbridge */
+        BRIDGE_STREAM,  /* stream to be restored on unbridge */
+
+        LAZY_LISTEN,    /* listen wanted, started on the next frame read/written */
+        LAZY_STREAM     /* stream wanted, started on the next frame written */
     }
     FlagType;
 
@@ -133,7 +140,8 @@ struct CommandRequest
         FLUSH_REC_STREAM,
         FLUSH_REC_BRIDGE,
         START_RECORD,
-        STOP_RECORD
+        STOP_RECORD,
+        NATIVE_UNBRIDGE
 
     }
     CodeType;
@@ -150,19 +158,22 @@ struct CommandRequest
     CommandRequest() : 
         _type(NONE),
         _code(CNONE),
-        _obj(-1)
+        _obj(-1),
+        _peer(-1)
     {}
 
-    CommandRequest(ReqType type, CodeType code, int obj) : 
+    CommandRequest(ReqType type, CodeType code, int obj, int peer = -1) : 
             _type(type),
             _code(code),
-            _obj(obj)
+            _obj(obj),
+            _peer(peer)
     {}
 
     CommandRequest(const CommandRequest & cmd) : 
             _type(cmd._type), 
             _code(cmd._code), 
-            _obj(cmd._obj) 
+            _obj(cmd._obj),
+            _peer(cmd._peer)
     {}
 
     ~CommandRequest() {}
@@ -172,6 +183,7 @@ struct CommandRequest
         _type = cmd._type;
         _code = cmd._code;
         _obj = cmd._obj;
+        _peer = cmd._peer;
     }
 
     void mirror(const CommandRequest & cmd_request)
@@ -179,6 +191,7 @@ struct CommandRequest
         _type = cmd_request._type;
         _code = cmd_request._code;
         _obj = cmd_request._obj;
+        _peer = cmd_request._peer;
     }
 
     short type() { return _type; }
@@ -187,128 +200,170 @@ struct CommandRequest
 
     int obj() { return _obj; }
 
+    /* the other channel involved, if any (for NATIVE_UNBRIDGE, *
+     * the one 'obj' should still be bridged with).             */
+    int peer() { return _peer; }
+
 private:
     short _type;
     short _code;
     int   _obj;
+    int   _peer;
 };
 
-struct EventRequest
+/* Storage for event parameters too large to fit inline on an EventRequest. *
+ * Blocks come from two fixed (static) size classes, taken and given back    *
+ * with a CAS on a bitmap, so K3L threads may allocate concurrently; the    *
+ * heap is used only if the class is exhausted or the parameters are even   *
+ * larger, and each time it happens is counted.                             */
+struct EventParamPool
 {
-    /* "empty" constructor */
-    EventRequest(bool can_delete = true) : 
-        _delete(can_delete), 
-        _obj(-1)
-    {
-        if(can_delete)
-            _event = new K3L_EVENT();
-    }
+    static const unsigned int small_size  = 1024;
+    static const unsigned int small_count = 32;
 
-    /* Temporary constructor */
-    EventRequest(int obj, K3L_EVENT * ev) :
-            _delete(false),
-            _obj(obj),
-            _event(ev)
-    {}
-    
-    //EventRequest(const EventRequest & ev) : _obj(ev._obj) {}
+    static const unsigned int large_size  = 8192;
+    static const unsigned int large_count = 8;
 
-    ~EventRequest()
-    {
+    static char * alloc(unsigned int size);
+    static void   release(char * block);
 
-        if(!_delete || !_event)
-            return;
+    static unsigned long pooled(void) { return _pooled; }
+    static unsigned long heap(void)   { return _heap;   }
 
-        if(_event->ParamSize)
-            free(_event->Params);
+ protected:
+    static char * take(volatile unsigned int & used, char * base, unsigned int size);
 
-        delete _event;
-    }
+    static char _small[small_count][small_size];
+    static char _large[large_count][large_size];
 
-    void operator=(const EventRequest & ev)
-    {
-        _delete = false;
-        _obj = ev._obj;
-        _event = ev._event;
+    static volatile unsigned int  _small_used;
+    static volatile unsigned int  _large_used;
 
-    }
+    static volatile unsigned long _pooled;
+    static volatile unsigned long _heap;
+};
+
+struct EventRequest
+{
+    /* most K3L events carry no parameters, or a short string/structure */
+    static const unsigned int inline_size = 256;
 
-    void mirror(const EventRequest & ev_request)
+    /* Temporary constructor (points to the K3L event, nothing is copied) */
+    EventRequest(int obj, K3L_EVENT * ev) :
+            _obj(obj),
+            _event(ev),
+            _block(NULL)
+    {}
+
+    /* copies the event and its parameters (built in place on the event fifo) */
+    EventRequest(const EventRequest & ev_request) :
+            _obj(ev_request._obj),
+            _event(&_copy),
+            _block(NULL)
     {
-        //Checar o _event
+        K3L_EVENT * ev = ev_request._event;
 
-        if(_event->ParamSize)
+        if (!ev)
         {
-            free(_event->Params);
+            _copy.Code       = -1;
+            _copy.AddInfo    = -1;
+            _copy.DeviceId   = -1;
+            _copy.ObjectInfo = -1;
+            _copy.Params     = NULL;
+            _copy.ParamSize  = 0;
+            _copy.ObjectId   = -1;
+            return;
         }
 
-        _event->Params = NULL;
-
-        _obj = ev_request._obj;
+        _copy        = *ev;
+        _copy.Params = NULL;
 
-        K3L_EVENT * ev     = ev_request._event;
-
-        if(!ev)
+        if (ev->ParamSize <= 0 || !ev->Params)
         {
-            clearEvent();
+            _copy.ParamSize = 0;
             return;
         }
 
-        _event->Code       = ev->Code;       // API code
-        _event->AddInfo    = ev->AddInfo;    // Parameter 1
-        _event->DeviceId   = ev->DeviceId;   // Hardware information
-        _event->ObjectInfo = ev->ObjectInfo; // Additional object information
-        _event->ParamSize  = ev->ParamSize;  // Size of parameter buffer
-        _event->ObjectId   = ev->ObjectId;   // KEventObjectId: Event thrower object id
+        char * params = _params;
 
-        if(ev->ParamSize)
+        if ((unsigned int)ev->ParamSize > inline_size)
         {
-            // Pointer to the parameter buffer
-            _event->Params = malloc(ev->ParamSize+1);
-            memcpy(_event->Params, ev->Params, ev->ParamSize);
-            ((char *)(_event->Params))[ev->ParamSize] = 0;
+            params = _block = EventParamPool::alloc(ev->ParamSize + 1);
+
+            if (!params)
+            {
+                _copy.ParamSize = 0;
+                return;
+            }
         }
+
+        memcpy(params, ev->Params, ev->ParamSize);
+        params[ev->ParamSize] = 0;
+
+        _copy.Params = params;
     }
 
-    bool clearEvent()
+    ~EventRequest()
     {
-        _event->Code       = -1;
-        _event->AddInfo    = -1;
-        _event->DeviceId   = -1;
-        _event->ObjectInfo = -1;
-        _event->ParamSize  = 0;
-        _event->ObjectId   = -1;
+        if (_block)
+            EventParamPool::release(_block);
     }
 
     int obj() { return _obj; }
 
     K3L_EVENT * event() { return _event; }
 
-
 private:
-    bool        _delete;
+    /* copies only happen through the constructor above */
+    void operator=(const EventRequest &);
+
     int         _obj;
     K3L_EVENT * _event;
+
+    K3L_EVENT   _copy;
+    char      * _block;                    /* from EventParamPool, if too large */
+    char        _params[inline_size + 1];  /* parameters plus a terminating zero */
 };
 
 template < typename R, int S >
 struct GenericFifo
 {
     typedef R RequestType;
-    typedef SimpleNonBlockLock<25,100>  LockType;
+    typedef MpscQueue < RequestType > Queue;
 
     GenericFifo(int device) : 
             _device(device), 
             _shutdown(false), 
+            _waiting(false),
             _buffer(S), 
-            _mutex(Globals::module_pool), 
             _cond(Globals::module_pool)
     {};
 
+    /* producers only touch the condition when the consumer is sleeping */
+    void notify()
+    {
+        __sync_synchronize();
+
+        if (Atomic::doLoad(&_waiting))
+            _cond.signal();
+    }
+
+    /* consumer side: sleeps until something is published (or shutdown) */
+    void wait()
+    {
+        Atomic::doStore(&_waiting, true);
+        __sync_synchronize();
+
+        if (_buffer.empty())
+            _cond.wait();
+
+        Atomic::doStore(&_waiting, false);
+    }
+
     int                         _device;
     bool                        _shutdown;
-    Ringbuffer < RequestType >  _buffer;
-    LockType                    _mutex; /* to sync write acess to event list */
+    volatile bool               _waiting;
+    Queue                       _buffer;
     SavedCondition              _cond;
     Thread                     *_thread;
 
@@ -40,7 +40,9 @@
 
 #define KHOMP_SYNTAX "USAGE:\n"\
                      "\tkhomp help\n"\
-                     "\tkhomp show [info|links|channels|conf]\n\n"
+                     "\tkhomp show [info|links|channels|conf|commands]\n"\
+                     "\tkhomp show audio [bN[cM]]\n"\
+                     "\tkhomp record [start|stop] <device> <channel>\n\n"
 
 #include <string>
 
@@ -51,6 +53,9 @@
 #include "opt.h"
 #include "utils.h"
 #include "globals.h"
+#include "supervisor.h"
+#include "shm_export.h"
+#include "media.h"
 
 /*!
  \brief Callback generated from K3L API for every new event on the board.
@@ -159,6 +164,14 @@ void apiPrintLinks(switch_stream_handle_t* stream, unsigned int device,
  \brief Print board channel status. [khomp show channels]
  */
 void apiPrintChannels(switch_stream_handle_t* stream);
+/*!
+ \brief Print command counters and rates. [khomp show commands]
+ */
+void apiPrintCommands(switch_stream_handle_t* stream);
+/*!
+ \brief Print audio path statistics. [khomp show audio [bN[cM]]]
+ */
+void apiPrintAudio(switch_stream_handle_t* stream, const char * spec);
 
 /*!
    \brief State methods they get called when the state changes to the specific state
@@ -288,6 +301,9 @@ switch_status_t channel_on_hangup(switch_core_session_t *session)
 
         //lock.unlock();
 
+        /* audio stats are cleared when the channel is cleaned up */
+        tech_pvt->setAudioVariables(channel);
+
         CommandRequest c_req(CommandRequest::COMMAND, CommandRequest::CMD_HANGUP, tech_pvt->target().object);
 
         Board::board(tech_pvt->target().device)->chanCommandHandler()->write(c_req);
@@ -346,6 +362,7 @@ switch_status_t channel_kill_channel(switch_core_session_t *session, int sig)
     case SWITCH_SIG_BREAK:
         DBG(FUNC,"CHANNEL KILL, BREAK!")
         switch_set_flag_locked(tech_pvt, TFLAG_BREAK);
+        tech_pvt->_reader_cond.signal();
         break;
     default:
         DBG(FUNC,"CHANNEL KILL, WHAT?!")
@@ -415,8 +432,39 @@ switch_status_t channel_read_frame(switch_core_session_t *session, switch_frame_
             return SWITCH_STATUS_SUCCESS;
         }
 
-        if (tech_pvt->call()->_flags.check(Kflags::LISTEN_UP))
+        /* starts listening, if it was left for freeswitch to ask */
+        tech_pvt->media_read();
+
+        /* a media bug was attached: it needs host audio */
+        if (tech_pvt->call()->_flags.check(Kflags::NATIVE_BRIDGE) && switch_core_media_bug_count(session) > 0)
+        {
+            try
+            {
+                ScopedPvtLock lock(tech_pvt);
+                tech_pvt->native_unbridge();
+            }
+            catch (ScopedLockFailed & err)
+            {
+                K::Logger::Logg(C_ERROR, PVT_FMT(tech_pvt->target(), "unable to lock %s!") % err._msg.c_str());
+            }
+        }
+
+        if (tech_pvt->call()->_flags.check(Kflags::NATIVE_BRIDGE))
         {
+            /* audio goes through the board: just keep the bridge loop slow */
+            tech_pvt->_reader_cond.wait(KHOMP_NATIVE_BRIDGE_WAIT);
+
+            *frame = tech_pvt->_reader_frames.cng();
+        }
+        else if (tech_pvt->call()->_flags.check(Kflags::LISTEN_UP))
+        {
+            /* set by the supervisor after a listener stall */
+            if (tech_pvt->_reader_flush)
+            {
+                tech_pvt->_reader_flush = false;
+                tech_pvt->_reader_frames.flush();
+            }
+
             *frame = tech_pvt->_reader_frames.pick();
 
             if (!*frame)
@@ -425,8 +473,45 @@ switch_status_t channel_read_frame(switch_core_session_t *session, switch_frame_
 //                    "Reader buffer empty, waiting... (%u,%02u).\n",
 //                    tech_pvt->target().device, tech_pvt->target().object);
 
-                switch_cond_next();
-                continue;
+                /* sleep until the audio listener completes a packet (or two packets time) */
+                const unsigned int timeout = 2 * tech_pvt->_reader_frames.packet_duration();
+
+                bool signaled = tech_pvt->_reader_cond.wait(timeout);
+
+                ++tech_pvt->_reader_stats.wakeups;
+
+                if (signaled)
+                    continue;
+
+                ++tech_pvt->_reader_stats.timeouts;
+
+                /* repeat the last pitch period, fading out, before giving up to CNG */
+                *frame = tech_pvt->concealFrame();
+
+                if (*frame)
+                    ++tech_pvt->_reader_stats.concealed;
+                else
+                    *frame = tech_pvt->_reader_frames.cng();
+            }
+            else
+            {
+                ++tech_pvt->_reader_stats.frames;
+
+                tech_pvt->refreshVolumes();
+
+                /* in batched mode, gain was applied by the media thread */
+                const unsigned char * gain = (tech_pvt->_reader_frames.batched() ? NULL : tech_pvt->inputGain());
+
+                if (gain && !((*frame)->flags & SFF_CNG))
+                {
+                    G711::apply(gain, (const char *)(*frame)->data, (char *)(*frame)->data, (*frame)->datalen);
+                }
+
+                /* keeps history for concealment, smoothing the end of a gap */
+                if ((*frame)->flags & SFF_CNG)
+                    tech_pvt->_reader_plc.reset();
+                else if (tech_pvt->_reader_plc.enabled())
+                    tech_pvt->_reader_plc.good((char *)(*frame)->data, (*frame)->datalen);
             }
 //            else
 //            {
@@ -440,6 +525,16 @@ switch_status_t channel_read_frame(switch_core_session_t *session, switch_frame_
             *frame = tech_pvt->_reader_frames.cng();
         }
 
+        if (switch_test_flag(tech_pvt, TFLAG_LINEAR) && !((*frame)->flags & SFF_CNG))
+        {
+            *frame = tech_pvt->linearFrame(*frame);
+        }
+        else if (switch_test_flag(tech_pvt, TFLAG_ULAW) && !((*frame)->flags & SFF_CNG))
+        {
+            /* the slot is held until the next read, convert in place */
+            G711::alaw_to_ulaw((const char *)(*frame)->data, (char *)(*frame)->data, (*frame)->datalen);
+        }
+
 #ifdef BIGENDIAN
         if (switch_test_flag(tech_pvt, TFLAG_LINEAR))
         {
@@ -493,9 +588,64 @@ switch_status_t channel_write_frame(switch_core_session_t *session, switch_frame
     }
 #endif
 
+    /* audio is going through the board mixer */
+    if (tech_pvt->call()->_flags.check(Kflags::NATIVE_BRIDGE))
+    {
+        return SWITCH_STATUS_SUCCESS;
+    }
+
+    /* starts streaming, if it was left for freeswitch to ask */
+    tech_pvt->media_write();
+
     if (frame) // && frame->flags != SFF_CNG)
     {
-        if (!tech_pvt->_writer_frames.give((const char *)frame->data, (size_t)frame->datalen))
+        const char * data = (const char *)frame->data;
+        unsigned int size = frame->datalen;
+
+        char alaw[Globals::switch_packet_max_size];
+
+        /* the read path may not be running at all (native bridge, no *
+         * audio from the board), so this one reloads volumes too.    */
+        tech_pvt->refreshVolumes();
+
+        const unsigned char * gain = tech_pvt->outputGain();
+
+        if (switch_test_flag(tech_pvt, TFLAG_LINEAR))
+        {
+            size = std::min<unsigned int>(frame->datalen / sizeof(int16_t), sizeof(alaw));
+
+            G711::linear_to_alaw((const int16_t *)frame->data, alaw, size);
+
+            data = alaw;
+
+            if (gain)
+                G711::apply(gain, alaw, alaw, size);
+        }
+        else if (switch_test_flag(tech_pvt, TFLAG_ULAW))
+        {
+            size = std::min<unsigned int>(frame->datalen, sizeof(alaw));
+
+            G711::ulaw_to_alaw(data, alaw, size);
+
+            data = alaw;
+
+            if (gain)
+                G711::apply(gain, alaw, alaw, size);
+        }
+        else if (gain)
+        {
+            /* frame data belongs to freeswitch: apply while copying */
+            size = std::min<unsigned int>(frame->datalen, sizeof(alaw));
+
+            G711::apply(gain, data, alaw, size);
+
+            data = alaw;
+        }
+
+        /* size is in A-law bytes, 8 bytes per ms */
+        tech_pvt->_writer_playout.arrival(size / 8);
+
+        if (!tech_pvt->_writer_frames.give(data, size))
         {
             /*
                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
@@ -614,6 +764,74 @@ switch_status_t khomp_answer(switch_core_session_t *session)
 }
 
 
+/* returns the pvt of a khomp session given its uuid, if it is one */
+static Board::KhompPvt * native_bridge_peer(const char * uuid)
+{
+    if (!uuid)
+        return NULL;
+
+    switch_core_session_t * peer_session = switch_core_session_locate(uuid);
+
+    if (!peer_session)
+        return NULL;
+
+    Board::KhompPvt * peer = NULL;
+
+    if (switch_core_session_get_endpoint_interface(peer_session) == Globals::khomp_endpoint_interface)
+        peer = static_cast<Board::KhompPvt*>(switch_core_session_get_private(peer_session));
+
+    switch_core_session_rwunlock(peer_session);
+
+    return peer;
+}
+
+/* each leg cross-connects its own half, under its own lock (never both at *
+ * once, the peer may be doing the same right now); if the peer half can't *
+ * be done, ours is undone, otherwise audio would only go one way.         */
+static void native_bridge_legs(Board::KhompPvt * pvt, Board::KhompPvt * peer)
+{
+    bool ours = false, theirs = false;
+
+    try
+    {
+        ScopedPvtLock lock(pvt);
+        ours = pvt->native_bridge(peer);
+    }
+    catch (ScopedLockFailed & err)
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(pvt->target(), "unable to lock %s!") % err._msg.c_str());
+    }
+
+    if (!ours)
+        return;
+
+    try
+    {
+        ScopedPvtLock lock(peer);
+        theirs = peer->native_bridge(pvt);
+    }
+    catch (ScopedLockFailed & err)
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(peer->target(), "unable to lock %s!") % err._msg.c_str());
+    }
+
+    if (theirs)
+        return;
+
+    K::Logger::Logg(C_WARNING, PVT_FMT(pvt->target(), "unable to bridge channel %d natively, removing native bridge.")
+        % peer->target().object);
+
+    try
+    {
+        ScopedPvtLock lock(pvt);
+        pvt->native_unbridge();
+    }
+    catch (ScopedLockFailed & err)
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(pvt->target(), "unable to lock %s!") % err._msg.c_str());
+    }
+}
+
 switch_status_t channel_receive_message(switch_core_session_t *session, switch_core_session_message_t *msg)
 {
     Board::KhompPvt *tech_pvt;
@@ -651,6 +869,28 @@ switch_status_t channel_receive_message(switch_core_session_t *session, switch_c
     case SWITCH_MESSAGE_INDICATE_PROGRESS:
         tech_pvt->indicateProgress();
         break;
+    case SWITCH_MESSAGE_INDICATE_BRIDGE:
+        if (Opt::_native_bridge)
+        {
+            Board::KhompPvt * peer = native_bridge_peer(msg->string_arg);
+
+            if (peer && peer->target().device == tech_pvt->target().device)
+                native_bridge_legs(tech_pvt, peer);
+        }
+        break;
+    case SWITCH_MESSAGE_INDICATE_UNBRIDGE:
+    case SWITCH_MESSAGE_INDICATE_MEDIA:
+        /* host audio is needed again (bridge ended, or media requested) */
+        try
+        {
+            ScopedPvtLock lock(tech_pvt);
+            tech_pvt->native_unbridge();
+        }
+        catch (ScopedLockFailed & err)
+        {
+            K::Logger::Logg(C_ERROR, PVT_FMT(tech_pvt->target(), "unable to lock %s!") % err._msg.c_str());
+        }
+        break;
     default:
         break;
     }
@@ -696,7 +936,7 @@ switch_call_cause_t channel_outgoing_channel
     {
         ScopedPvtLock lock(tech_pvt);
 
-        if(tech_pvt->justAlloc(false, pool) != SWITCH_STATUS_SUCCESS)
+        if(tech_pvt->justAlloc(false, pool, session) != SWITCH_STATUS_SUCCESS)
         {
             K::Logger::Logg(C_ERROR,"Initilization Error!");
             return SWITCH_CAUSE_DESTINATION_OUT_OF_ORDER;
@@ -896,6 +1136,10 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_khomp_load)
     switch_console_set_complete("add khomp show links");
     switch_console_set_complete("add khomp show channels");
     switch_console_set_complete("add khomp show conf");
+    switch_console_set_complete("add khomp show commands");
+    switch_console_set_complete("add khomp show audio");
+    switch_console_set_complete("add khomp record start");
+    switch_console_set_complete("add khomp record stop");
 
     Board::initializeHandlers();
 
@@ -985,6 +1229,14 @@ SWITCH_STANDARD_API(apiKhomp)
         if (argv[1] && !strncasecmp(argv[1], "conf", 4)) {
             Opt::printConfiguration(stream);
         }
+        /* Show command rates */
+        if (argv[1] && !strncasecmp(argv[1], "commands", 8)) {
+            apiPrintCommands(stream);
+        }
+        /* Show audio path statistics */
+        if (argv[1] && !strncasecmp(argv[1], "audio", 5)) {
+            apiPrintAudio(stream, argv[2]);
+        }
         // Show all channels from all boards and all links
         if (argv[1] && !strncasecmp(argv[1], "channels", 8)) {
             /* TODO: Let show specific channels */
@@ -992,6 +1244,40 @@ SWITCH_STANDARD_API(apiKhomp)
             //printChannels(stream, NULL, NULL);
         }
 
+    } else if (argv[0] && !strncasecmp(argv[0], "record", 6)) {
+        /* Start or stop recording a channel */
+        if (argc < 4) {
+            stream->write_function(stream, "%s", KHOMP_SYNTAX);
+            goto done;
+        }
+
+        CommandRequest::CodeType code;
+
+        if (!strncasecmp(argv[1], "start", 5))
+            code = CommandRequest::START_RECORD;
+        else if (!strncasecmp(argv[1], "stop", 4))
+            code = CommandRequest::STOP_RECORD;
+        else {
+            stream->write_function(stream, "%s", KHOMP_SYNTAX);
+            goto done;
+        }
+
+        int device = atoi(argv[2]);
+        int object = atoi(argv[3]);
+
+        Board * board = Board::lookupBoard(device);
+
+        if (!board || !Board::lookup(device, object)) {
+            stream->write_function(stream, "-ERR invalid channel %d,%02d\n", device, object);
+            goto done;
+        }
+
+        /* files are opened in the command thread, not here */
+        CommandRequest c_req(CommandRequest::ACTION, code, object);
+        board->chanCommandHandler()->write(c_req);
+
+        stream->write_function(stream, "+OK\n");
+
     } else {
         stream->write_function(stream, "%s", KHOMP_SYNTAX);
     }
@@ -1236,27 +1522,274 @@ void printSystemSummary(switch_stream_handle_t* stream) {
 
     stream->write_function(stream, " ------------------------------------------------------------------\n");
 }
+void apiPrintCommands(switch_stream_handle_t* stream)
+{
+    /* rates are calculated since the last time this was called */
+    static switch_time_t last_time     = 0;
+    static unsigned long last_commands = 0;
+    static unsigned long last_streams  = 0;
+    static unsigned long last_packets  = 0;
+
+    const switch_time_t now      = switch_micro_time_now();
+    const unsigned long commands = Globals::k3lapi.command_count();
+    const unsigned long streams  = Board::_stream_commands;
+    const unsigned long packets  = Board::_stream_packets;
+
+    const double elapsed = (last_time ? (double)(now - last_time) / 1000000.0 : 0.0);
+
+    stream->write_function(stream, " ------------------------------------------------------------------\n");
+    stream->write_function(stream, "|------------------------ Khomp Commands --------------------------|\n");
+    stream->write_function(stream, "|------------------------------------------------------------------|\n");
+    stream->write_function(stream, "| K3L commands:          %12lu | %12.1f per second  |\n",
+            commands, (elapsed > 0.0 ? (double)(commands - last_commands) / elapsed : 0.0));
+    stream->write_function(stream, "| Stream buffer commands: %11lu | %12.1f per second  |\n",
+            streams, (elapsed > 0.0 ? (double)(streams - last_streams) / elapsed : 0.0));
+    stream->write_function(stream, "| Stream buffer packets:  %11lu | %12.2f per command |\n",
+            packets, (streams - last_streams ? (double)(packets - last_packets) / (double)(streams - last_streams) : 0.0));
+    stream->write_function(stream, "|------------------------------------------------------------------|\n");
+
+    for (unsigned int dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+    {
+        Board * board = Board::lookupBoard(dev);
+
+        if (!board || !board->chanEventHandler() || !board->chanCommandHandler())
+            continue;
+
+        EventFifo   * events   = board->chanEventHandler()->fifo();
+        CommandFifo * commands = board->chanCommandHandler()->fifo();
+
+        /* high-water marks and enqueue failures since the module was loaded */
+        stream->write_function(stream, "| b%02d events   queue: %6u max %6u slots %12lu dropped |\n",
+                dev, events->_buffer.high_water(), events->_buffer.capacity(), events->_buffer.failures());
+        stream->write_function(stream, "| b%02d commands queue: %6u max %6u slots %12lu dropped |\n",
+                dev, commands->_buffer.high_water(), commands->_buffer.capacity(), commands->_buffer.failures());
+    }
+
+    /* events with parameters too large to be stored inline */
+    stream->write_function(stream, "| Large event parameters: %11lu pooled %11lu from heap |\n",
+            EventParamPool::pooled(), EventParamPool::heap());
+
+    if (ShmExport::enabled())
+    {
+        stream->write_function(stream, "| Shared memory export:   %12lu records %11lu dropped |\n",
+                ShmExport::exported(), ShmExport::dropped());
+    }
+
+    stream->write_function(stream, " ------------------------------------------------------------------\n");
+
+    last_time     = now;
+    last_commands = commands;
+    last_streams  = streams;
+    last_packets  = packets;
+}
+
+template < unsigned int N >
+static void printHistogram(switch_stream_handle_t* stream, const char * name, const Histogram< N > & h)
+{
+    const unsigned long total = h.total();
+
+    stream->write_function(stream, "|   %-14s", name);
+
+    for (unsigned int i = 0; i < N; i++)
+        stream->write_function(stream, " %5.1f", (total ? (100.0 * (double)h[i]) / (double)total : 0.0));
+
+    stream->write_function(stream, " %% |\n");
+}
+
+void apiPrintAudio(switch_stream_handle_t* stream, const char * spec)
+{
+    int only_device = -1;
+    int only_object = -1;
+
+    if (spec && sscanf(spec, "b%dc%d", &only_device, &only_object) < 1)
+    {
+        stream->write_function(stream, "-ERR invalid channel '%s' (use bN or bNcM)\n", spec);
+        return;
+    }
+
+    stream->write_function(stream, " ---------------------------------------------------------------------------\n");
+    stream->write_function(stream, "|----------------------------- Khomp Audio Path ----------------------------|\n");
+    stream->write_function(stream, "|    occupancy buckets: 0 1 2 3 4 5 6 7+ packets                            |\n");
+    stream->write_function(stream, "|    delay buckets:     0 1 2-3 4-7 8-15 16-31 32-63 64+ ms                 |\n");
+    stream->write_function(stream, " ---------------------------------------------------------------------------\n");
+
+    for (unsigned int dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+    {
+        if (only_device >= 0 && (int)dev != only_device)
+            continue;
+
+        for (unsigned int obj = 0; obj < Globals::k3lapi.channel_count(dev); obj++)
+        {
+            if (only_object >= 0 && (int)obj != only_object)
+                continue;
+
+            Board::KhompPvt * pvt = Board::lookup(dev, obj);
+
+            if (!pvt)
+                continue;
+
+            /* finished calls plus the current one */
+            Board::KhompPvt::AudioStats s;
+
+            s.add(pvt->audioTotals());
+            pvt->audioStats(s);
+
+            /* when listing everything, skip channels that never had audio */
+            if (only_object < 0 && !s.rx_frames && !s.rx_cng && !s.tx_occupancy.total())
+                continue;
+
+            stream->write_function(stream, "| b%02dc%02d: %lu calls%54s|\n", dev, obj, s.calls, "");
+            stream->write_function(stream, "|   rx: %10lu frames %8lu cng    %8lu overflows %8lu dropped |\n",
+                s.rx_frames, s.rx_cng, s.rx_overflows, s.rx_dropped);
+            if (s.rx_concealed)
+            {
+                stream->write_function(stream, "|   plc: %10lu frames concealed%48s|\n", s.rx_concealed, "");
+            }
+
+            stream->write_function(stream, "|   tx: %10lu underruns             %8lu overflows %8lu dropped |\n",
+                s.tx_underruns, s.tx_overflows, s.tx_dropped);
+
+            if (s.tx_inserted || s.tx_deleted)
+            {
+                stream->write_function(stream, "|   drift: %8lu samples inserted, %8lu deleted%30s|\n",
+                    s.tx_inserted, s.tx_deleted, "");
+            }
+
+            if (s.stalls)
+            {
+                stream->write_function(stream, "|   listener: %8lu stalls, %10lu ms without audio%24s|\n",
+                    s.stalls, s.stall_ms, "");
+            }
+
+            printHistogram(stream, "rx occupancy:", s.rx_occupancy);
+            printHistogram(stream, "tx occupancy:", s.tx_occupancy);
+            printHistogram(stream, "rx delay:",     s.rx_delay);
+            printHistogram(stream, "tx delay:",     s.tx_delay);
+        }
+    }
+
+    /* listener stall incidents are not tied to a single channel */
+    if (only_device >= 0)
+    {
+        stream->write_function(stream, " ---------------------------------------------------------------------------\n");
+        return;
+    }
+
+    Supervisor::Summary sup;
+    Supervisor::summary(sup);
+
+    stream->write_function(stream, "|----------------------------- Listener Stalls -----------------------------|\n");
+    stream->write_function(stream, "| incidents: %6lu channel %6lu board %6lu global%24s|\n",
+        sup.incidents[Supervisor::SC_CHANNEL], sup.incidents[Supervisor::SC_BOARD], sup.incidents[Supervisor::SC_GLOBAL], "");
+    stream->write_function(stream, "| K3L events: %6lu timeouts %6lu overflows%31s|\n",
+        sup.timeouts, sup.overflows, "");
+
+    for (Supervisor::IncidentVector::iterator i = sup.recent.begin(); i != sup.recent.end(); i++)
+    {
+        stream->write_function(stream, "|   %-7s b%02d%-4s %3d channels %8d ms %4d re-arms%25s|\n",
+            Supervisor::scopeName(i->scope), (i->scope == Supervisor::SC_GLOBAL ? 0 : i->device),
+            (i->scope == Supervisor::SC_CHANNEL ? STG(FMT("c%02d") % i->object).c_str() : ""),
+            i->channels, i->duration(), i->rearms, "");
+    }
+
+    for (Supervisor::IncidentVector::iterator i = sup.open.begin(); i != sup.open.end(); i++)
+    {
+        stream->write_function(stream, "|   %-7s b%02d%-4s %3d channels   (ongoing) %4d re-arms%25s|\n",
+            Supervisor::scopeName(i->scope), (i->scope == Supervisor::SC_GLOBAL ? 0 : i->device),
+            (i->scope == Supervisor::SC_CHANNEL ? STG(FMT("c%02d") % i->object).c_str() : ""),
+            i->channels, i->rearms, "");
+    }
+
+    stream->write_function(stream, " ---------------------------------------------------------------------------\n");
+}
+
 /* End of helper functions */
 
 
 extern "C" void Kstdcall khomp_audio_listener (int32 deviceid, int32 objectid, byte * read_buffer, int32 read_size)
 {
-    Board::KhompPvt * pvt = Board::get(deviceid, objectid);
+    Board::KhompPvt * pvt = Board::lookup(deviceid, objectid);
 
     if (!pvt)
         return;
 
+    bool complete = false;
+
+    /* for the stall supervisor */
+    pvt->_listen_stamp = FrameStorage::now_ms();
+
+    /* audio queued before a stall (or overflow) is stale now */
+    if (pvt->_writer_flush)
+    {
+        pvt->_writer_flush = false;
+        pvt->_writer_frames.flush();
+    }
+
+    /* recording tap, if active (never blocks) */
+    pvt->_record_tap.rx((const char *)read_buffer, read_size);
+
+    if (ShmExport::enabled())
+        ShmExport::audio(ShmRecord::SR_AUDIO_RX, deviceid, objectid, (const char *)read_buffer, read_size);
+
     /* add listener audio to the read buffer */
-    if (!pvt->_reader_frames.give((const char *)read_buffer, read_size))
+    if (!pvt->_reader_frames.give((const char *)read_buffer, read_size, complete))
     {
         DBG(FUNC, OBJ_FMT(deviceid,objectid, "Reader buffer full (read_size: %d)") % read_size);
     }
 
-    /* push audio from the write buffer */
-    switch_frame_t * fr = pvt->_writer_frames.pick();
+    /* wake up the reader only when it has something to pick (in *
+     * batched mode, the media thread does, after processing it)  */
+    if (complete)
+    {
+        if (pvt->_reader_frames.batched())
+            MediaTick::arrived(pvt);
+        else
+            pvt->_reader_cond.signal();
+    }
+
+    /* push audio from the write buffer, if the playout control allows */
+    Playout::ActionType action = pvt->_writer_playout.tick(
+            pvt->_writer_frames.count(), pvt->_writer_frames.capacity());
+
+    if (action == Playout::PO_WAIT)
+    {
+        pvt->_record_tap.tx_silence(read_size);
+        return;
+    }
+
+    switch_frame_t * fr = NULL;
+
+    if (action == Playout::PO_SHRINK)
+    {
+        fr = pvt->_writer_frames.pick();
+
+        if (fr && FrameStorage::silent((const char *)fr->data, fr->datalen))
+        {
+            /* too much audio buffered: skip this silent packet */
+            pvt->_writer_playout.shrunk();
+            fr = NULL;
+        }
+    }
+
+    if (!fr)
+    {
+        /* if there is a backlog, send it using a single command */
+        const unsigned int depth  = pvt->_writer_frames.count();
+        const unsigned int target = (pvt->_writer_playout.enabled() ? pvt->_writer_playout.target() : 1);
+
+        unsigned int amount = 1;
+
+        if (depth > target)
+            amount = std::min(Opt::_stream_buffer_packets, depth - target + 1);
+
+        fr = pvt->_writer_frames.pick(amount);
+    }
 
     if (!fr)
     {
+        pvt->_writer_playout.underrun();
+        pvt->_record_tap.tx_silence(read_size);
+
         /*
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG,
             "Writer buffer empty! (%u,%02u).\n",
@@ -1268,6 +1801,7 @@ extern "C" void Kstdcall khomp_audio_listener (int32 deviceid, int32 objectid, b
     if (!pvt->call()->_flags.check(Kflags::STREAM_UP))
     {
         DBG(FUNC, PVT_FMT(pvt->target(), "Stream not enabled, skipping write..."));
+        pvt->_record_tap.tx_silence(read_size);
         return;
     }
 
@@ -1287,10 +1821,35 @@ extern "C" void Kstdcall khomp_audio_listener (int32 deviceid, int32 objectid, b
             write_packet.buff = (const byte *) fr->data;
             write_packet.size = (size_t)       fr->datalen;
 
+            /* clock drift compensation: one sample more or less */
+            char stretched[Globals::boards_packet_size * KHOMP_MAX_AUDIO_BUFFER_LENGTH + 1];
+
+            const int delta = pvt->_writer_playout.correction();
+
+            if (delta != 0 && fr->datalen < sizeof(stretched))
+            {
+                const unsigned int size = Playout::stretch((const char *)fr->data, fr->datalen, stretched, delta);
+
+                if (size)
+                {
+                    write_packet.buff = (const byte *) stretched;
+                    write_packet.size = (size_t)       size;
+
+                    pvt->_writer_playout.corrected();
+                }
+            }
 
             pvt->command(KHOMP_LOG, CM_ADD_STREAM_BUFFER,
                     (const char *)&write_packet);
 
+            pvt->_record_tap.tx((const char *)write_packet.buff, write_packet.size);
+
+            if (ShmExport::enabled())
+                ShmExport::audio(ShmRecord::SR_AUDIO_TX, deviceid, objectid, (const char *)write_packet.buff, write_packet.size);
+
+            Atomic::doAdd(&Board::_stream_commands);
+            Atomic::doAdd(&Board::_stream_packets, (unsigned long)(fr->datalen / Globals::boards_packet_size));
+
             break;
         }
 
@@ -1302,6 +1861,14 @@ extern "C" void Kstdcall khomp_audio_listener (int32 deviceid, int32 objectid, b
             pvt->command(KHOMP_LOG, CM_ADD_STREAM_BUFFER,
                     (const char *)&write_packet);
 
+            pvt->_record_tap.tx((const char *)Board::_cng_buffer, Globals::cng_buffer_size);
+
+            if (ShmExport::enabled())
+                ShmExport::audio(ShmRecord::SR_AUDIO_TX, deviceid, objectid, (const char *)Board::_cng_buffer, Globals::cng_buffer_size);
+
+            Atomic::doAdd(&Board::_stream_commands);
+            Atomic::doAdd(&Board::_stream_packets);
+
             break;
         }
 
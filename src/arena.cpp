@@ -0,0 +1,182 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <new>
+
+#include "arena.h"
+#include "globals.h"
+#include "defs.h"
+#include "logger.h"
+
+/* 2MB is the usual huge page size on x86 */
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+char   * AudioArena::_base      = NULL;
+size_t   AudioArena::_size      = 0;
+size_t   AudioArena::_used      = 0;
+bool     AudioArena::_hugepages = false;
+bool     AudioArena::_locked    = false;
+
+bool AudioArena::initialize(size_t size, bool hugepages, bool lock)
+{
+    if (_base || !size)
+        return false;
+
+    void * base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (hugepages)
+    {
+        size_t huge_size = (size + HUGEPAGE_SIZE - 1) & ~((size_t)HUGEPAGE_SIZE - 1);
+
+        base = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (base == MAP_FAILED)
+        {
+            K::Logger::Logg(C_WARNING, FMT("unable to allocate %d bytes of huge pages for audio buffers: %s, using normal pages.")
+                % huge_size % strerror(errno));
+        }
+        else
+        {
+            size = huge_size;
+        }
+    }
+#else
+    if (hugepages)
+        K::Logger::Logg(C_WARNING, "huge pages are not supported on this system, using normal pages for audio buffers.");
+#endif
+
+    _hugepages = (base != MAP_FAILED);
+
+    if (base == MAP_FAILED)
+    {
+        size = (size + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (base == MAP_FAILED)
+        {
+            K::Logger::Logg(C_ERROR, FMT("unable to allocate %d bytes for audio buffers: %s, using heap.")
+                % size % strerror(errno));
+            return false;
+        }
+    }
+
+    _locked = (lock && mlock(base, size) == 0);
+
+    if (lock && !_locked)
+    {
+        K::Logger::Logg(C_WARNING, FMT("unable to lock audio buffer memory in RAM: %s. This is not a "
+            "catastrophic failure, but may cause unpredictable audio delay under extreme load conditions.")
+                % strerror(errno));
+    }
+
+    _base = (char *)base;
+    _size = size;
+    _used = 0;
+
+    DBG(CONF, FMT("audio arena: %d bytes at %p (%s pages%s)") % _size % base
+        % (_hugepages ? "huge" : "normal") % (_locked ? ", locked" : ""));
+
+    return true;
+}
+
+void AudioArena::finalize(void)
+{
+    if (!_base)
+        return;
+
+    if (_locked)
+        munlock(_base, _size);
+
+    munmap(_base, _size);
+
+    _base   = NULL;
+    _locked = false;
+    _size = 0;
+    _used = 0;
+}
+
+void * AudioArena::alloc(size_t size)
+{
+    size = align(size);
+
+    if (_base && (_used + size) <= _size)
+    {
+        void * ptr = (void *)(_base + _used);
+
+        _used += size;
+
+        /* mmap'ed memory is already zeroed */
+        return ptr;
+    }
+
+    if (_base)
+    {
+        K::Logger::Logg(C_WARNING, FMT("audio arena exhausted (%d of %d bytes used), using heap for %d bytes.")
+            % _used % _size % size);
+    }
+
+    void * ptr = NULL;
+
+    /* callers use it right away, as they did with new */
+    if (posix_memalign(&ptr, cache_line, size) != 0)
+        throw std::bad_alloc();
+
+    memset(ptr, 0, size);
+
+    return ptr;
+}
+
+void AudioArena::release(void * ptr)
+{
+    /* memory from the arena is only released at finalize */
+    if (ptr && !contains(ptr))
+        free(ptr);
+}
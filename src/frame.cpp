@@ -42,14 +42,25 @@
 *******************************************************************************/
 
 #include "frame.h"
+#include "arena.h"
 
-#define ALLOC(T,s) ((T*)calloc(1,s))
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ALLOC(T,s) ((T*)AudioArena::alloc(s))
 
 /* Internal frame manager structure. */
-FrameStorage::FrameStorage(switch_codec_t * codec, int packet_size)
+FrameStorage::FrameStorage(switch_codec_t * codec, int packet_size, unsigned int count)
 :  _frames(ALLOC(switch_frame_t, frame_count * sizeof(switch_frame_t))),
-   _buffer(ALLOC(          char, audio_count * packet_size)),
-   _index(0)
+   _buffer(ALLOC(          char, SpscRingbuffer_traits::slots_for(count) * packet_size)),
+   _info(ALLOC(      SlotInfo, SpscRingbuffer_traits::slots_for(count) * sizeof(SlotInfo))),
+   _index(0),
+   _slot_size(packet_size),
+   _packet_size(packet_size),
+   _count(count),
+   _timestamp(0u),
+   _seq(0u)
 {
     for (unsigned int i = 0; i < frame_count; i++)
     {
@@ -96,29 +107,123 @@ FrameStorage::FrameStorage(switch_codec_t * codec, int packet_size)
     _cng_frame.ssrc       = 0u;
     _cng_frame.m          = SWITCH_FALSE;
     _cng_frame.flags      = SFF_CNG;
-
-//    if (mlock(&_frames, frames_size) < 0)
-//    {
-//        DBG(CONF, F("Unable to lock ast_frame buffer memory in RAM: %s") % strerror(errno));
-//        std::cerr << "chan_khomp: Unable to lock ast_frame buffer memory in RAM: "
-//            << strerror(errno) << ". "
-//                << "This is not a catastrophic failure, but may cause unpredictable "
-//                << "audio delay under extreme load conditions." << std::endl;
-//    }
-//
-//    if (mlock(&_buffer, buffer_size) < 0)
-//    {
-//        DBG(CONF, F("Unable to lock audio buffer memory in RAM: %s") % strerror(errno));
-//        std::cerr << "chan_khomp: Unable to lock temporary audio buffer memory in RAM: "
-//                << strerror(errno) << ". "
-//                    << "This is not a catastrophic failure, but may cause unpredictable "
-//                    << "audio delay under extreme load conditions." << std::endl;
-//    }
 };
 
 FrameStorage::~FrameStorage()
 {
-    free(_frames);
-    free(_buffer);
+    AudioArena::release(_frames);
+    AudioArena::release(_buffer);
+    AudioArena::release(_info);
+}
+
+void FrameStorage::audio_buffer_count(unsigned int count)
+{
+    /* allocate first: if it throws, the old buffers are kept */
+    char * buffer = ALLOC(char, SpscRingbuffer_traits::slots_for(count) * _slot_size);
+
+    SlotInfo * info = NULL;
+
+    try
+    {
+        info = ALLOC(SlotInfo, SpscRingbuffer_traits::slots_for(count) * sizeof(SlotInfo));
+    }
+    catch (...)
+    {
+        AudioArena::release(buffer);
+        throw;
+    }
+
+    AudioArena::release(_buffer);
+    AudioArena::release(_info);
+
+    _buffer = buffer;
+    _info   = info;
+    _count  = count;
+}
+
+size_t FrameStorage::storage_size(unsigned int slot_size, unsigned int count)
+{
+    return AudioArena::align(frame_count * sizeof(switch_frame_t))
+         + buffer_size(slot_size, count);
+}
+
+size_t FrameStorage::buffer_size(unsigned int slot_size, unsigned int count)
+{
+    const unsigned int slots = SpscRingbuffer_traits::slots_for(count);
+
+    return AudioArena::align(slots * slot_size) + AudioArena::align(slots * sizeof(SlotInfo));
+}
+
+bool FrameStorage::policy_from_name(const std::string & name, PolicyType & policy)
+{
+    if (name == "drop-newest")
+        policy = BP_DROP_NEWEST;
+    else if (name == "drop-oldest")
+        policy = BP_DROP_OLDEST;
+    else if (name == "compress-silence")
+        policy = BP_COMPRESS_SILENCE;
+    else
+        return false;
+
+    return true;
+}
+
+const char * FrameStorage::policy_name(PolicyType policy)
+{
+    switch (policy)
+    {
+        case BP_DROP_NEWEST:      return "drop-newest";
+        case BP_DROP_OLDEST:      return "drop-oldest";
+        case BP_COMPRESS_SILENCE: return "compress-silence";
+    }
+
+    return "unknown";
+}
+
+bool FrameStorage::silent(const char * buf, unsigned int size)
+{
+    /* A-law samples have even bits inverted; after undoing that, the low *
+     * 7 bits are segment and step. segments 0 and 1 mean |x| < 64 (out  *
+     * of 4096), which is around -36dBov: low enough to be thrown away.   */
+    unsigned int i = 0;
+
+#ifdef __SSE2__
+    const __m128i invert = _mm_set1_epi8(0x55);
+    const __m128i level  = _mm_set1_epi8(0x7f);
+    const __m128i limit  = _mm_set1_epi8(0x1f);
+
+    /* same test, 16 samples at a time (levels are 0-127, so a signed compare does) */
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+
+        v = _mm_and_si128(_mm_xor_si128(v, invert), level);
+
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(v, limit)) != 0)
+            return false;
+    }
+#endif
+
+    for (; i < size; i++)
+    {
+        if ((((unsigned char)buf[i] ^ 0x55) & 0x7f) >= 0x20)
+            return false;
+    }
+
+    return true;
+}
+
+void FrameStorage::packet_size(unsigned int size)
+{
+    _packet_size = size;
+
+    for (unsigned int i = 0; i < frame_count; i++)
+    {
+        _frames[i].datalen    = size;
+        _frames[i].buflen     = size;
+        _frames[i].samples    = size;
+    }
+
+    _cng_frame.samples = size;
 }
 
@@ -0,0 +1,341 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+/* vector kernels are built for AVX2 regardless of the compiler flags, and *
+ * picked at runtime ('initialize') only if the CPU supports it.           */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define G711_AVX2
+#include <immintrin.h>
+#endif
+
+#include <math.h>
+
+#include "g711.h"
+
+const double  G711::gain_step_db = 2.0;
+
+int32_t       G711::_decode[256];
+unsigned char G711::_encode[8192];
+unsigned char G711::_gain[G711::gain_max - G711::gain_min + 1][256];
+unsigned char G711::_alaw_ulaw[256];
+unsigned char G711::_ulaw_alaw[256];
+
+G711::ToLinearType G711::_to_linear = &G711::alaw_to_linear_table;
+G711::ToAlawType   G711::_to_alaw   = &G711::linear_to_alaw_table;
+
+/* reference conversions (as in ITU-T G.711 / Sun's g711.c) */
+static int16_t alaw_decode(unsigned char a)
+{
+    a ^= 0x55;
+
+    int t   = (a & 0x0f) << 4;
+    int seg = (a & 0x70) >> 4;
+
+    switch (seg)
+    {
+        case 0:
+            t += 8;
+            break;
+        case 1:
+            t += 0x108;
+            break;
+        default:
+            t += 0x108;
+            t <<= seg - 1;
+            break;
+    }
+
+    return (int16_t)((a & 0x80) ? t : -t);
+}
+
+static unsigned char alaw_encode(int16_t linear)
+{
+    static const int seg_end[8] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+
+    int value = linear >> 3;
+    int mask;
+
+    if (value >= 0)
+    {
+        mask = 0xD5;
+    }
+    else
+    {
+        mask  = 0x55;
+        value = -value - 1;
+    }
+
+    int seg = 0;
+
+    while (seg < 8 && value > seg_end[seg])
+        ++seg;
+
+    if (seg >= 8)
+        return (unsigned char)(0x7F ^ mask);
+
+    int a = seg << 4;
+
+    if (seg < 2)
+        a |= (value >> 1) & 0x0f;
+    else
+        a |= (value >> seg) & 0x0f;
+
+    return (unsigned char)(a ^ mask);
+}
+
+static int16_t ulaw_decode(unsigned char u)
+{
+    u = ~u;
+
+    int t = ((u & 0x0f) << 3) + 0x84;
+
+    t <<= (u & 0x70) >> 4;
+
+    return (int16_t)((u & 0x80) ? (0x84 - t) : (t - 0x84));
+}
+
+static unsigned char ulaw_encode(int16_t linear)
+{
+    static const int seg_end[8] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF };
+
+    int value = linear >> 2;
+    int mask;
+
+    if (value < 0)
+    {
+        value = -value;
+        mask  = 0x7F;
+    }
+    else
+    {
+        mask  = 0xFF;
+    }
+
+    /* clip to the maximum magnitude, then bias */
+    if (value > 0x1FDF)
+        value = 0x1FDF;
+
+    value += (0x84 >> 2);
+
+    int seg = 0;
+
+    while (seg < 8 && value > seg_end[seg])
+        ++seg;
+
+    if (seg >= 8)
+        return (unsigned char)(0x7F ^ mask);
+
+    return (unsigned char)(((seg << 4) | ((value >> (seg + 1)) & 0x0F)) ^ mask);
+}
+
+void G711::initialize(void)
+{
+    for (unsigned int i = 0; i < 256; i++)
+        _decode[i] = alaw_decode((unsigned char)i);
+
+    /* the three lowest bits are discarded by the encoder anyway */
+    for (unsigned int i = 0; i < 8192; i++)
+        _encode[i] = alaw_encode((int16_t)(i << 3));
+
+    for (int step = gain_min; step <= gain_max; step++)
+    {
+        const double factor = pow(10.0, (step * gain_step_db) / 20.0);
+
+        for (unsigned int i = 0; i < 256; i++)
+        {
+            double value = rint(_decode[i] * factor);
+
+            /* saturate instead of wrapping around */
+            if (value >  32767.0) value =  32767.0;
+            if (value < -32768.0) value = -32768.0;
+
+            _gain[step - gain_min][i] = alaw_encode((int16_t)value);
+        }
+    }
+
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        _alaw_ulaw[i] = ulaw_encode(alaw_decode((unsigned char)i));
+        _ulaw_alaw[i] = alaw_encode(ulaw_decode((unsigned char)i));
+    }
+
+#ifdef G711_AVX2
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        _to_linear = &alaw_to_linear_avx2;
+        _to_alaw   = &linear_to_alaw_avx2;
+    }
+#endif
+}
+
+bool G711::vectorized(void)
+{
+    return (_to_linear != &alaw_to_linear_table);
+}
+
+void G711::apply(const unsigned char * table, const char * in, char * out, unsigned int count)
+{
+    const unsigned char * src = (const unsigned char *)in;
+    unsigned char       * dst = (unsigned char *)out;
+
+    /* byte shuffles can only look up 16 entries at once, so a 256-entry *
+     * table would take 16 of them (plus masking) for 16 samples: plain  *
+     * loads are cheaper here, and the table stays in L1 cache anyway.   */
+    unsigned int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        dst[i]     = table[src[i]];
+        dst[i + 1] = table[src[i + 1]];
+        dst[i + 2] = table[src[i + 2]];
+        dst[i + 3] = table[src[i + 3]];
+    }
+
+    for (; i < count; i++)
+        dst[i] = table[src[i]];
+}
+
+void G711::alaw_to_linear_table(const char * in, int16_t * out, unsigned int count)
+{
+    const unsigned char * src = (const unsigned char *)in;
+
+    for (unsigned int i = 0; i < count; i++)
+        out[i] = (int16_t)_decode[src[i]];
+}
+
+void G711::linear_to_alaw_table(const int16_t * in, char * out, unsigned int count)
+{
+    /* a single byte load per sample, from a table that fits in L1 cache */
+    for (unsigned int i = 0; i < count; i++)
+        out[i] = _encode[((uint16_t)in[i]) >> 3];
+}
+
+#ifdef G711_AVX2
+
+__attribute__((target("avx2")))
+void G711::alaw_to_linear_avx2(const char * in, int16_t * out, unsigned int count)
+{
+    const unsigned char * src = (const unsigned char *)in;
+
+    unsigned int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        /* widen 8 codes to 32-bit indexes, then gather their values */
+        __m128i codes = _mm_loadl_epi64((const __m128i *)(src + i));
+        __m256i index = _mm256_cvtepu8_epi32(codes);
+        __m256i value = _mm256_i32gather_epi32((const int *)_decode, index, 4);
+
+        /* values fit in 16 bits: pack both halves back together */
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(value),
+                                         _mm256_extracti128_si256(value, 1));
+
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+
+    for (; i < count; i++)
+        out[i] = (int16_t)_decode[src[i]];
+}
+
+__attribute__((target("avx2")))
+void G711::linear_to_alaw_avx2(const int16_t * in, char * out, unsigned int count)
+{
+    /* there is no 16-bit gather, so this computes what 'alaw_encode' *
+     * does, on 16 samples at once: the segment is the count of        *
+     * segment ends the magnitude is above, and the mantissa the four  *
+     * bits right below the segment's leading bit.                     */
+    static const short seg_end[7] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF };
+
+    const __m256i low4 = _mm256_set1_epi16(0x0f);
+    const __m256i pos  = _mm256_set1_epi16(0xD5);
+    const __m256i neg  = _mm256_set1_epi16(0x55);
+
+    unsigned int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i value = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)(in + i)), 3);
+        __m256i sign  = _mm256_srai_epi16(value, 15);
+
+        /* -value - 1 on negatives, which is just ~value */
+        __m256i mag   = _mm256_xor_si256(value, sign);
+
+        __m256i seg   = _mm256_setzero_si256();
+        __m256i mant  = _mm256_srli_epi16(mag, 1);
+
+        __m256i above = _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(seg_end[0]));
+        seg = _mm256_sub_epi16(seg, above);
+
+#define G711_AVX2_SEGMENT(n) \
+        above = _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(seg_end[n - 1])); \
+        seg   = _mm256_sub_epi16(seg, above); \
+        mant  = _mm256_blendv_epi8(mant, _mm256_srli_epi16(mag, n), above);
+
+        G711_AVX2_SEGMENT(2);
+        G711_AVX2_SEGMENT(3);
+        G711_AVX2_SEGMENT(4);
+        G711_AVX2_SEGMENT(5);
+        G711_AVX2_SEGMENT(6);
+        G711_AVX2_SEGMENT(7);
+
+#undef G711_AVX2_SEGMENT
+
+        __m256i code = _mm256_or_si256(_mm256_slli_epi16(seg, 4), _mm256_and_si256(mant, low4));
+
+        code = _mm256_xor_si256(code, _mm256_blendv_epi8(pos, neg, sign));
+
+        /* codes fit in a byte: pack both halves back together */
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(code),
+                                          _mm256_extracti128_si256(code, 1));
+
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+
+    for (; i < count; i++)
+        out[i] = _encode[((uint16_t)in[i]) >> 3];
+}
+
+#endif
@@ -44,18 +44,47 @@
 #include "khomp_pvt.h"
 #include "lock.h"
 #include "khomp_pvt_kxe1.h"
+#include "spec.h"
+#include "arena.h"
+#include "supervisor.h"
+#include "media.h"
+#include "shm_export.h"
 
 Board::VectorBoard  Board::_boards;
 switch_mutex_t *    Board::_pvts_mutex;
 char                Board::_cng_buffer[128];
 
+ChannelTable < Board::KhompPvt > Board::_pvt_table;
+
+volatile unsigned long Board::_stream_commands = 0;
+volatile unsigned long Board::_stream_packets  = 0;
+
 Board::KhompPvt::KhompPvt(K3LAPI::target & target) :
   _target(target),
   _mutex(Globals::module_pool),
   _session(NULL),
   _caller_profile(NULL),
   _reader_frames(&_read_codec),
-  _writer_frames(&_write_codec) {}
+  _writer_frames(&_write_codec),
+  _reader_cond(Globals::module_pool),
+  _media_slice(0),
+  _listen_stamp(0),
+  _reader_flush(false),
+  _writer_flush(false),
+  _stalled(false),
+  _stall_since(0),
+  _stall_rearm(0),
+  _stalls(0),
+  _stall_ms(0),
+  _media_read_stamp(0),
+  _media_write_stamp(0),
+  _lazy_conn_rx(false),
+  _audio_wakes(0),
+  _audio_idles(0),
+  _bridge_peer(-1),
+  _input_volume(0),
+  _output_volume(0),
+  _volume_stamp(0) {}
 
 bool Board::initializeK3L(void)
 {
@@ -123,6 +152,10 @@ bool Board::finalizeHandlers(void)
     if (Globals::k3lapi.device_count() == 0)
         return false;
 
+    /* a stopped listener looks like a global stall: make sure it *
+     * is not registered again once unregistered below.           */
+    Supervisor::stop();
+
     k3lRegisterEventHandler( NULL );
     k3lRegisterAudioListener( NULL, NULL );
 
@@ -146,7 +179,10 @@ bool Board::finalizeHandlers(void)
         device->_command_handler = NULL;
     }
 
-    /* wait every thread to finalize */
+    /* wait every thread to finalize; this is also the grace period for *
+     * listener calls that started before it was unregistered, so the  *
+     * channels, the lookup table and whatever else the listener uses  *
+     * are only freed after this (see Board::finalize).                 */
     sleep(1);
 
     K::Logger::Logg(C_MESSAGE,"K3l event and audio handlers unregistered."); 
@@ -155,8 +191,25 @@ bool Board::finalizeHandlers(void)
 
 }
 
+void Board::initializeTable(void)
+{
+    unsigned int objects = 0;
+
+    for (unsigned dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+        objects = std::max(objects, Globals::k3lapi.channel_count(dev));
+
+    _pvt_table.initialize(Globals::k3lapi.device_count(), objects);
+}
+
+void Board::finalizeTable(void)
+{
+    /* the listener is gone by now (see finalizeHandlers) */
+    _pvt_table.finalize();
+}
+
 void Board::initializeBoards(void)
 {
+    initializeTable();
 
     for (unsigned dev = 0; dev < Globals::k3lapi.device_count(); dev++)
     {
@@ -210,8 +263,166 @@ void Board::initializeChannels(void)
         
         _channels.push_back(pvt);
 
+        _pvt_table.set(_device_id, obj, pvt);
+
         pvt->cleanup();
     }
+
+    initializeAudioBuffers();
+}
+
+struct funApplyAudioBuffers
+{
+    typedef std::vector < unsigned int >               LengthVector;
+    typedef std::vector < FrameStorage::PolicyType >   PolicyVector;
+
+    funApplyAudioBuffers(int device, LengthVector & lengths, PolicyVector & policies,
+        unsigned int length, FrameStorage::PolicyType policy)
+    : _device(device), _lengths(lengths), _policies(policies), _length(length), _policy(policy) {};
+
+    bool operator()(unsigned int dev, unsigned int obj, SpecFlagsType & flags)
+    {
+        if ((int)dev == _device && obj < _lengths.size())
+        {
+            _lengths[obj]  = _length;
+            _policies[obj] = _policy;
+        }
+
+        return true;
+    }
+
+    int                        _device;
+    LengthVector             & _lengths;
+    PolicyVector             & _policies;
+    unsigned int               _length;
+    FrameStorage::PolicyType   _policy;
+};
+
+void Board::initializeAudioBuffers(void)
+{
+    FrameStorage::PolicyType policy = FrameStorage::BP_DROP_NEWEST;
+
+    FrameStorage::policy_from_name(Opt::_audio_buffer_policy, policy);
+
+    /* settings are resolved first, so buffers get allocated only once */
+    funApplyAudioBuffers::LengthVector lengths(_channels.size(), Opt::_audio_buffer_length);
+    funApplyAudioBuffers::PolicyVector policies(_channels.size(), policy);
+
+    /* spans may override the global settings for some channels */
+    for (std::map<std::string, CSpan>::iterator i = Opt::_spans.begin(); i != Opt::_spans.end(); i++)
+    {
+        CSpan & span = (*i).second;
+
+        if (span._channels.empty())
+            continue;
+
+        unsigned int length = (span._audio_buffer_length ? span._audio_buffer_length : Opt::_audio_buffer_length);
+
+        FrameStorage::PolicyType span_policy = policy;
+
+        if (!span._audio_buffer_policy.empty())
+            FrameStorage::policy_from_name(span._audio_buffer_policy, span_policy);
+
+        funApplyAudioBuffers proc(_device_id, lengths, policies, length, span_policy);
+        SpecFunType          fun(proc, false);
+
+        if (!process_channel_string(span._channels, fun))
+        {
+            K::Logger::Logg(C_ERROR, FMT("invalid channels '%s' in span %s, using global audio buffer settings.")
+                % span._channels % (*i).first);
+        }
+    }
+
+    for (unsigned int obj = 0; obj < _channels.size(); obj++)
+        _channels[obj]->setupAudioBuffers(lengths[obj], policies[obj]);
+}
+
+void Board::KhompPvt::audioStats(AudioStats & s)
+{
+    FrameStorage::Stats & rd = _reader_frames.stats();
+    FrameStorage::Stats & wr = _writer_frames.stats();
+
+    s.rx_frames    += _reader_stats.frames - rd.suppressed;
+    s.rx_cng       += _reader_stats.timeouts - _reader_stats.concealed + rd.suppressed;
+    s.rx_overflows += rd.overflows;
+    s.rx_dropped   += rd.dropped + rd.silenced;
+    s.rx_concealed += _reader_stats.concealed;
+    s.tx_underruns += _writer_playout.stats().underruns;
+    s.tx_overflows += wr.overflows;
+    s.tx_dropped   += wr.dropped + wr.silenced;
+    s.tx_inserted  += _writer_playout.stats().inserted;
+    s.tx_deleted   += _writer_playout.stats().deleted;
+    s.stalls       += _stalls;
+    s.stall_ms     += _stall_ms;
+
+    s.rx_occupancy.add(rd.occupancy);
+    s.tx_occupancy.add(wr.occupancy);
+    s.rx_delay.add(rd.delay);
+    s.tx_delay.add(wr.delay);
+}
+
+template < unsigned int N >
+static std::string histogram_string(const Histogram< N > & h)
+{
+    std::string res;
+
+    for (unsigned int i = 0; i < N; i++)
+        res += STG(FMT("%s%d") % (i ? "," : "") % h[i]);
+
+    return res;
+}
+
+void Board::KhompPvt::setAudioVariables(switch_channel_t * channel)
+{
+    AudioStats s;
+    audioStats(s);
+
+    switch_channel_set_variable(channel, "khomp_audio_rx_frames",    STG(FMT("%d") % s.rx_frames).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_rx_cng",       STG(FMT("%d") % s.rx_cng).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_rx_overflows", STG(FMT("%d") % s.rx_overflows).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_rx_dropped",   STG(FMT("%d") % s.rx_dropped).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_rx_concealed", STG(FMT("%d") % s.rx_concealed).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_underruns", STG(FMT("%d") % s.tx_underruns).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_overflows", STG(FMT("%d") % s.tx_overflows).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_dropped",   STG(FMT("%d") % s.tx_dropped).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_inserted",  STG(FMT("%d") % s.tx_inserted).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_deleted",   STG(FMT("%d") % s.tx_deleted).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_stalls",       STG(FMT("%d") % s.stalls).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_stall_ms",     STG(FMT("%d") % s.stall_ms).c_str());
+
+    switch_channel_set_variable(channel, "khomp_audio_rx_occupancy", histogram_string(s.rx_occupancy).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_occupancy", histogram_string(s.tx_occupancy).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_rx_delay",     histogram_string(s.rx_delay).c_str());
+    switch_channel_set_variable(channel, "khomp_audio_tx_delay",     histogram_string(s.tx_delay).c_str());
+}
+
+void Board::KhompPvt::updateVolumes(void)
+{
+    if (!session())
+        return;
+
+    switch_channel_t * channel = switch_core_session_get_channel(session());
+
+    const char * input  = switch_channel_get_variable(channel, "KInputVolume");
+    const char * output = switch_channel_get_variable(channel, "KOutputVolume");
+
+    if (input)
+        _input_volume = atoi(input);
+
+    if (output)
+        _output_volume = atoi(output);
+}
+
+void Board::KhompPvt::setupAudioBuffers(unsigned int length, FrameStorage::PolicyType policy)
+{
+    DBG(CONF, PVT_FMT(_target, "audio buffers: %d packets, policy '%s'")
+        % length % FrameStorage::policy_name(policy));
+
+    _reader_frames.buffer_length(length);
+    _reader_frames.policy(policy);
+
+    _writer_frames.buffer_length(length);
+    _writer_frames.policy(policy);
 }
 
 
@@ -220,6 +431,8 @@ void Board::finalizeBoards(void)
     K::Logger::Logg(C_MESSAGE,"finalizing boards ..."); 
     switch_mutex_lock(_pvts_mutex);
 
+    finalizeTable();
+
     for (VectorBoard::iterator it_dev = _boards.begin();
                                it_dev != _boards.end();
                                it_dev++)
@@ -285,6 +498,33 @@ void Board::initializeCngBuffer(void)
     }
 }
 
+void Board::initializeArena(void)
+{
+    unsigned int channels = 0;
+
+    for (unsigned dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+        channels += Globals::k3lapi.channel_count(dev);
+
+    unsigned int length = Opt::_audio_buffer_length;
+
+    for (std::map<std::string, CSpan>::iterator i = Opt::_spans.begin(); i != Opt::_spans.end(); i++)
+        length = std::max(length, (*i).second._audio_buffer_length);
+
+    /* each channel allocates its default buffers when created, *
+     * and then resizes them once to their configured length.  */
+    size_t channel_size =
+        FrameStorage::storage_size(Globals::switch_packet_max_size, FrameStorage::audio_count) +
+        FrameStorage::storage_size(Globals::boards_packet_size,     FrameStorage::audio_count);
+
+    if (length != FrameStorage::audio_count)
+    {
+        channel_size += FrameStorage::buffer_size(Globals::switch_packet_max_size, length);
+        channel_size += FrameStorage::buffer_size(Globals::boards_packet_size,     length);
+    }
+
+    AudioArena::initialize(channels * channel_size, Opt::_audio_memory_hugepages, Opt::_audio_memory_lock);
+}
+
 bool Board::initialize(void)
 {
     //K::Logger::Logg(C_MESSAGE,""); 
@@ -296,15 +536,39 @@ bool Board::initialize(void)
 
     initializeCngBuffer();
 
+    G711::initialize();
+
+    Recorder::initialize();
+
+    ShmExport::initialize();
+
+    initializeArena();
+
     initializeBoards();
 
+    MediaTick::initialize();
+
+    Supervisor::initialize();
+
     return true;
 }
 
 bool Board::finalize(void)
 {
+    Supervisor::finalize();
+
+    MediaTick::finalize();
+
+    /* closes every recording still open */
+    Recorder::finalize();
+
     finalizeBoards();
 
+    /* only now: the listener and the event threads write there */
+    ShmExport::finalize();
+
+    AudioArena::finalize();
+
     switch_mutex_destroy(_pvts_mutex);
 
     return finalizeK3L();
@@ -331,7 +595,33 @@ void Board::khomp_add_event_board_data(const K3LAPI::target target, switch_event
     switch_event_add_header(event, SWITCH_STACK_BOTTOM, "Khomp-Object", "%u", target.object);
 }
 
-switch_status_t Board::KhompPvt::justAlloc(bool is_answering, switch_memory_pool_t **pool)
+const char * Board::KhompPvt::sessionCodec(switch_core_session_t * peer)
+{
+    if (peer && Opt::_match_peer_codec)
+    {
+        const switch_codec_t * codec = switch_core_session_get_read_codec(peer);
+
+        if (codec && codec->implementation && codec->implementation->actual_samples_per_second == 8000)
+        {
+            const char * name = codec->implementation->iananame;
+
+            /* no transcoding in the core, at most a table lookup here */
+            if (!strcasecmp(name, "PCMA")) return "PCMA";
+            if (!strcasecmp(name, "PCMU")) return "PCMU";
+            if (!strcasecmp(name, "L16"))  return "L16";
+        }
+    }
+
+    if (Opt::_linear_audio)
+        return "L16";
+
+    if (Opt::_ulaw_audio)
+        return "PCMU";
+
+    return "PCMA";
+}
+
+switch_status_t Board::KhompPvt::justAlloc(bool is_answering, switch_memory_pool_t **pool, switch_core_session_t * peer)
 {
     DBG(FUNC, PVT_FMT(target(), "c"));
 
@@ -357,7 +647,13 @@ switch_status_t Board::KhompPvt::justAlloc(bool is_answering, switch_memory_pool
 
     switch_core_session_add_stream(session(), NULL);
 
-    if (switch_core_codec_init(&_read_codec, "PCMA", NULL, 8000, Globals::switch_packet_duration, 1,
+    /* packet size is given in bytes, 8 bytes per ms */
+    const int packet_duration = Opt::_audio_packet_size / 8;
+
+    /* in linear and u-law modes, audio is converted to/from A-law here */
+    const char * codec = sessionCodec(peer);
+
+    if (switch_core_codec_init(&_read_codec, codec, NULL, 8000, packet_duration, 1,
             SWITCH_CODEC_FLAG_ENCODE | SWITCH_CODEC_FLAG_DECODE, NULL,
                 Globals::module_pool) != SWITCH_STATUS_SUCCESS)
     {
@@ -368,7 +664,7 @@ switch_status_t Board::KhompPvt::justAlloc(bool is_answering, switch_memory_pool
         return SWITCH_STATUS_FALSE;
     }
 
-    if (switch_core_codec_init(&_write_codec, "PCMA", NULL, 8000, Globals::switch_packet_duration, 1,
+    if (switch_core_codec_init(&_write_codec, codec, NULL, 8000, packet_duration, 1,
             SWITCH_CODEC_FLAG_ENCODE | SWITCH_CODEC_FLAG_DECODE, NULL,
                 Globals::module_pool) != SWITCH_STATUS_SUCCESS)
     {
@@ -378,10 +674,32 @@ switch_status_t Board::KhompPvt::justAlloc(bool is_answering, switch_memory_pool
         return SWITCH_STATUS_FALSE;
     }
 
+    /* frames going to freeswitch follow the codec packetization */
+    _reader_frames.packet_size(Opt::_audio_packet_size);
+    _reader_frames.vad(Opt::_suppress_silence, Opt::_silence_hangover);
+    _reader_frames.batched(MediaTick::enabled());
+
+    _reader_plc.limit(Opt::_reader_concealment);
+    _reader_plc.reset();
+
+    _writer_playout.enabled(Opt::_adaptive_playout);
+    _writer_playout.compensate(Opt::_drift_compensation);
+
+    _input_volume   = Opt::_input_volume;
+    _output_volume  = Opt::_output_volume;
+    _volume_stamp   = FrameStorage::now_ms();
+
     //TODO: Retirar daqui
     switch_mutex_init(&flag_mutex, SWITCH_MUTEX_NESTED,
                 switch_core_session_get_pool(_session));
 
+    if (!strcmp(codec, "L16"))
+        switch_set_flag_locked(this, TFLAG_LINEAR);
+    else if (!strcmp(codec, "PCMU"))
+        switch_set_flag_locked(this, TFLAG_ULAW);
+
+    DBG(FUNC, PVT_FMT(target(), "session codec: %s") % codec);
+
     switch_core_session_set_private(_session, this);
 
     if((switch_core_session_set_read_codec(_session, &_read_codec) !=
@@ -654,6 +972,76 @@ bool Board::KhompPvt::cleanup(CleanupType type)
 {
     flags = 0;
 
+    if (_reader_stats.frames || _reader_stats.timeouts)
+    {
+        /* counters are cleared below, so this is only added once per call */
+        AudioStats call;
+        audioStats(call);
+
+        call.calls = 1;
+        _audio_totals.add(call);
+
+        DBG(STRM, PVT_FMT(_target, "reader: %d frames, %d wakeups (%.2f per frame), %d timeouts (%d concealed)")
+            % _reader_stats.frames % _reader_stats.wakeups
+            % (_reader_stats.frames ? (double)_reader_stats.wakeups / (double)_reader_stats.frames : 0.0)
+            % _reader_stats.timeouts % _reader_stats.concealed);
+    }
+
+    _reader_stats.clear();
+
+    if (_stalls)
+    {
+        DBG(STRM, PVT_FMT(_target, "listener: %d stalls, %d ms without audio") % _stalls % _stall_ms);
+    }
+
+    _stalls   = 0;
+    _stall_ms = 0;
+
+    if (_audio_wakes || _audio_idles)
+    {
+        DBG(STRM, PVT_FMT(_target, "lazy audio: %d wakes, %d idles") % _audio_wakes % _audio_idles);
+    }
+
+    _audio_wakes  = 0;
+    _audio_idles  = 0;
+    _lazy_conn_rx = false;
+
+    FrameStorage::Stats & rd = _reader_frames.stats();
+    FrameStorage::Stats & wr = _writer_frames.stats();
+
+    if (rd.overflows || wr.overflows)
+    {
+        DBG(STRM, PVT_FMT(_target, "buffers: reader %d overflows (%d dropped, %d silence), writer %d overflows (%d dropped, %d silence)")
+            % rd.overflows % rd.dropped % rd.silenced % wr.overflows % wr.dropped % wr.silenced);
+    }
+
+    if (rd.suppressed)
+    {
+        DBG(STRM, PVT_FMT(_target, "reader: %d silent packets sent as CNG") % rd.suppressed);
+    }
+
+    rd.clear();
+    wr.clear();
+
+    Playout::Stats & po = _writer_playout.stats();
+
+    if (po.inserted || po.deleted)
+    {
+        DBG(STRM, PVT_FMT(_target, "playout: drift compensation inserted %d and deleted %d samples")
+            % po.inserted % po.deleted);
+    }
+
+    if (po.underruns || po.shrinks || po.depth_max > 1)
+    {
+        DBG(STRM, PVT_FMT(_target, "playout: %d underruns, %d shrinks, depth %.2f avg, %d max, target %d (jitter %dms)")
+            % po.underruns % po.shrinks
+            % (po.depth_ticks ? (double)po.depth_sum / (double)po.depth_ticks : 0.0)
+            % po.depth_max % _writer_playout.target() % _writer_playout.jitter());
+    }
+
+    _writer_playout.reset();
+    _reader_plc.reset();
+
     _reader_frames.clear();
     _writer_frames.clear();
     
@@ -683,6 +1071,8 @@ bool Board::KhompPvt::cleanup(CleanupType type)
     case CLN_FAIL:
         stop_stream();
         stop_listen();
+        native_unbridge();
+        stopRecording();
         doHangup();
         call()->_flags.clear(Kflags::IS_INCOMING);
         call()->_flags.clear(Kflags::IS_OUTGOING);
@@ -878,6 +1268,25 @@ bool Board::KhompPvt::start_stream(void)
     if (call()->_flags.check(Kflags::STREAM_UP))
         return true;
 
+    /* mixer is being used by the bridge, start it later */
+    if (call()->_flags.check(Kflags::NATIVE_BRIDGE))
+    {
+        call()->_flags.set(Kflags::BRIDGE_STREAM);
+        return true;
+    }
+
+    /* started by the first frame written, see media_write */
+    if (Opt::_lazy_audio)
+    {
+        call()->_flags.set(Kflags::LAZY_STREAM);
+        return true;
+    }
+
+    return arm_stream();
+}
+
+bool Board::KhompPvt::arm_stream(void)
+{
     try
     {
         Globals::k3lapi.mixer(_target, 0, kmsPlay, _target.object);
@@ -889,13 +1298,19 @@ bool Board::KhompPvt::start_stream(void)
         return false;
     }
 
+    call()->_flags.clear(Kflags::LAZY_STREAM);
     call()->_flags.set(Kflags::STREAM_UP);
 
+    _media_write_stamp = FrameStorage::now_ms();
+
     return true;
 }
 
 bool Board::KhompPvt::stop_stream(void)
 {
+    call()->_flags.clear(Kflags::BRIDGE_STREAM);
+    call()->_flags.clear(Kflags::LAZY_STREAM);
+
     if (!call()->_flags.check(Kflags::STREAM_UP))
         return true;
 
@@ -920,9 +1335,29 @@ bool Board::KhompPvt::start_listen(bool conn_rx)
     if (call()->_flags.check(Kflags::LISTEN_UP))
         return true;
 
+    if (call()->_flags.check(Kflags::NATIVE_BRIDGE))
+    {
+        call()->_flags.set(Kflags::BRIDGE_LISTEN);
+        return true;
+    }
+
+    /* started by the first frame read or written, see media_read */
+    if (Opt::_lazy_audio)
+    {
+        _lazy_conn_rx |= conn_rx;
+
+        call()->_flags.set(Kflags::LAZY_LISTEN);
+        return true;
+    }
+
+    return arm_listen(conn_rx);
+}
+
+bool Board::KhompPvt::arm_listen(bool conn_rx)
+{
     const size_t buffer_size = Globals::boards_packet_duration;
 
-    if (conn_rx)
+    if (conn_rx || _lazy_conn_rx)
     {
         try
         {
@@ -938,6 +1373,13 @@ bool Board::KhompPvt::start_listen(bool conn_rx)
     if (!command(KHOMP_LOG, CM_LISTEN, (const char *) &buffer_size))
         return false;
 
+    /* supervision starts counting from here */
+    _listen_stamp = FrameStorage::now_ms();
+
+    _media_read_stamp = _listen_stamp;
+    _lazy_conn_rx     = false;
+
+    call()->_flags.clear(Kflags::LAZY_LISTEN);
     call()->_flags.set(Kflags::LISTEN_UP);
 
     return true;
@@ -945,6 +1387,9 @@ bool Board::KhompPvt::start_listen(bool conn_rx)
 
 bool Board::KhompPvt::stop_listen(void)
 {
+    call()->_flags.clear(Kflags::BRIDGE_LISTEN);
+    call()->_flags.clear(Kflags::LAZY_LISTEN);
+
     if(!call()->_flags.check(Kflags::LISTEN_UP))
         return true;
 
@@ -955,9 +1400,271 @@ bool Board::KhompPvt::stop_listen(void)
 
     call()->_flags.clear(Kflags::LISTEN_UP);
 
+    /* do not let the reader wait for audio that will not come */
+    _reader_cond.signal();
+
     return true;
 }
 
+void Board::KhompPvt::wake_audio(bool writing)
+{
+    try
+    {
+        ScopedPvtLock lock(this);
+
+        /* may have been started (or the call ended) meanwhile */
+        const bool listen = call()->_flags.check(Kflags::LAZY_LISTEN);
+        const bool stream = writing && call()->_flags.check(Kflags::LAZY_STREAM);
+
+        if (!listen && !stream)
+            return;
+
+        /* the stream is paced by the audio listener, so both are needed */
+        if (listen && !arm_listen(false))
+            return;
+
+        if (stream && !arm_stream())
+            return;
+
+        ++_audio_wakes;
+
+        DBG(STRM, PVT_FMT(_target, "audio woken up by freeswitch %s (listen %s, stream %s)")
+            % (writing ? "writing" : "reading")
+            % (call()->_flags.check(Kflags::LISTEN_UP) ? "up" : "down")
+            % (call()->_flags.check(Kflags::STREAM_UP) ? "up" : "down"));
+    }
+    catch (ScopedLockFailed & err)
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(_target, "unable to lock %s!") % err._msg.c_str());
+    }
+}
+
+void Board::KhompPvt::idle_audio(uint32_t now, uint32_t timeout)
+{
+    const bool stream_idle = call()->_flags.check(Kflags::STREAM_UP) &&
+        (int32_t)(now - _media_write_stamp) >= (int32_t)timeout;
+
+    /* while streaming, the listener is needed to pace the writer */
+    const bool listen_idle = call()->_flags.check(Kflags::LISTEN_UP) &&
+        (int32_t)(now - _media_read_stamp)  >= (int32_t)timeout &&
+        (int32_t)(now - _media_write_stamp) >= (int32_t)timeout &&
+        !_record_tap.active();
+
+    if (!stream_idle && !listen_idle)
+        return;
+
+    try
+    {
+        ScopedPvtLock lock(this);
+
+        if (call()->_flags.check(Kflags::NATIVE_BRIDGE))
+            return;
+
+        bool idled = false;
+
+        if (stream_idle && call()->_flags.check(Kflags::STREAM_UP) && stop_stream())
+        {
+            call()->_flags.set(Kflags::LAZY_STREAM);
+            idled = true;
+        }
+
+        if (listen_idle && !call()->_flags.check(Kflags::STREAM_UP) &&
+            call()->_flags.check(Kflags::LISTEN_UP) && stop_listen())
+        {
+            call()->_flags.set(Kflags::LAZY_LISTEN);
+            idled = true;
+        }
+
+        if (idled)
+        {
+            ++_audio_idles;
+
+            DBG(STRM, PVT_FMT(_target, "audio idle for %dms (listen %s, stream %s)") % timeout
+                % (call()->_flags.check(Kflags::LISTEN_UP) ? "up" : "down")
+                % (call()->_flags.check(Kflags::STREAM_UP) ? "up" : "down"));
+        }
+    }
+    catch (ScopedLockFailed & err)
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(_target, "unable to lock %s!") % err._msg.c_str());
+    }
+}
+
+bool Board::KhompPvt::rearm_audio(void)
+{
+    if (call()->_flags.check(Kflags::NATIVE_BRIDGE))
+        return true;
+
+    bool ok = true;
+
+    if (call()->_flags.check(Kflags::LISTEN_UP))
+    {
+        const size_t buffer_size = Globals::boards_packet_duration;
+
+        command(KHOMP_LOG, CM_STOP_LISTEN);
+
+        /* keeps LISTEN_UP on failure, so the supervisor tries again */
+        if (!command(KHOMP_LOG, CM_LISTEN, (const char *) &buffer_size))
+            ok = false;
+    }
+
+    if (call()->_flags.check(Kflags::STREAM_UP))
+    {
+        try
+        {
+            Globals::k3lapi.command(_target, CM_STOP_STREAM_BUFFER);
+            Globals::k3lapi.command(_target, CM_START_STREAM_BUFFER);
+        }
+        catch(...)
+        {
+            K::Logger::Logg(C_ERROR, PVT_FMT(target(), "ERROR re-arming STREAM_BUFFER!"));
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+bool Board::KhompPvt::native_bridge(KhompPvt * peer)
+{
+    if (!peer || peer == this || peer->target().device != target().device)
+        return false;
+
+    if (call()->_flags.check(Kflags::NATIVE_BRIDGE))
+        return (_bridge_peer == (int)peer->target().object);
+
+    if (!native_bridge_allowed() || !peer->native_bridge_allowed())
+    {
+        DBG(FUNC, PVT_FMT(target(), "media bugs or recording need host audio, not bridging natively."));
+        return false;
+    }
+
+    /* lazily wanted audio is restored as wanted as well */
+    const bool listening = call()->_flags.check(Kflags::LISTEN_UP) || call()->_flags.check(Kflags::LAZY_LISTEN);
+    const bool streaming = call()->_flags.check(Kflags::STREAM_UP) || call()->_flags.check(Kflags::LAZY_STREAM);
+
+    if (!stop_listen() || !stop_stream())
+    {
+        K::Logger::Logg(C_WARNING, PVT_FMT(target(), "unable to stop host audio, not bridging natively."));
+
+        if (listening) start_listen(false);
+        if (streaming) start_stream();
+
+        return false;
+    }
+
+    /* play what the peer receives on our line (the peer does the same) */
+    if (!mixer(KHOMP_LOG, 0, kmsChannel, peer->target().object))
+    {
+        if (listening) start_listen(false);
+        if (streaming) start_stream();
+
+        return false;
+    }
+
+    call()->_flags.set(Kflags::NATIVE_BRIDGE);
+
+    _bridge_peer = peer->target().object;
+
+    if (listening) call()->_flags.set(Kflags::BRIDGE_LISTEN);
+    if (streaming) call()->_flags.set(Kflags::BRIDGE_STREAM);
+
+    DBG(FUNC, PVT_FMT(target(), "natively bridged with channel %d") % peer->target().object);
+
+    return true;
+}
+
+bool Board::KhompPvt::native_unbridge(void)
+{
+    if (!call()->_flags.check(Kflags::NATIVE_BRIDGE))
+        return true;
+
+    const bool listening = call()->_flags.check(Kflags::BRIDGE_LISTEN);
+    const bool streaming = call()->_flags.check(Kflags::BRIDGE_STREAM);
+
+    call()->_flags.clear(Kflags::NATIVE_BRIDGE);
+    call()->_flags.clear(Kflags::BRIDGE_LISTEN);
+    call()->_flags.clear(Kflags::BRIDGE_STREAM);
+
+    mixer(KHOMP_LOG, 0, kmsGenerator, kmtSilence);
+
+    bool ok = true;
+
+    if (listening && !start_listen(false))
+        ok = false;
+
+    if (streaming && !start_stream())
+        ok = false;
+
+    DBG(FUNC, PVT_FMT(target(), "native bridge removed (host audio %s)") % (ok ? "restored" : "NOT restored"));
+
+    /* the peer still plays our line instead of its host audio: remove *
+     * its side too (from its command thread, as it has its own lock). */
+    const int peer = _bridge_peer;
+
+    _bridge_peer = -1;
+
+    Board * board = Board::lookupBoard(target().device);
+
+    if (peer >= 0 && board && board->chanCommandHandler())
+    {
+        CommandRequest c_req(CommandRequest::ACTION, CommandRequest::NATIVE_UNBRIDGE, peer, target().object);
+        board->chanCommandHandler()->write(c_req);
+    }
+
+    return ok;
+}
+
+bool Board::KhompPvt::native_bridge_allowed(void)
+{
+    if (_record_tap.active())
+        return false;
+
+    return !(session() && switch_core_media_bug_count(session()) > 0);
+}
+
+bool Board::KhompPvt::startRecording(void)
+{
+    if (!Opt::_recording)
+    {
+        K::Logger::Logg(C_WARNING, PVT_FMT(target(), "recording is disabled by configuration."));
+        return false;
+    }
+
+    if (_record_tap.active())
+        return true;
+
+    const bool wav = (Opt::_record_format == "wav");
+
+    if (!Recorder::start(_record_tap, Recorder::filename(target().device, target().object, wav), wav))
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(target(), "unable to start recording."));
+        return false;
+    }
+
+    /* recording taps host audio, which a native bridge bypasses */
+    try
+    {
+        ScopedPvtLock lock(this);
+        native_unbridge();
+    }
+    catch (ScopedLockFailed & err)
+    {
+        K::Logger::Logg(C_ERROR, PVT_FMT(target(), "unable to lock %s!") % err._msg.c_str());
+    }
+
+    /* recording taps the listener, it can't wait for freeswitch */
+    if (call()->_flags.check(Kflags::LAZY_LISTEN))
+        wake_audio(false);
+
+    return true;
+}
+
+void Board::KhompPvt::stopRecording(void)
+{
+    Recorder::stop(_record_tap);
+}
+
 bool Board::KhompPvt::obtainRX(bool with_delay)
 {
     //TODO: Implementar direitinho
@@ -1620,7 +2327,10 @@ int Board::KhompPvt::doChannelHangup(CommandRequest &cmd)
         stop_stream();
 
         stop_listen();
-        
+
+        native_unbridge();
+
+        stopRecording();
     }
     catch (ScopedLockFailed & err)
     {
@@ -1658,6 +2368,33 @@ int Board::KhompPvt::commandHandler(CommandRequest &cmd)
         break;
 
     case CommandRequest::ACTION:
+        switch(cmd.code())
+        {
+        case CommandRequest::START_RECORD:
+            if (!startRecording())
+                ret = ksFail;
+            break;
+        case CommandRequest::STOP_RECORD:
+            stopRecording();
+            break;
+        case CommandRequest::NATIVE_UNBRIDGE:
+            try
+            {
+                ScopedPvtLock lock(this);
+
+                /* may have been bridged with someone else since it was queued */
+                if (_bridge_peer == cmd.peer())
+                    native_unbridge();
+            }
+            catch (ScopedLockFailed & err)
+            {
+                K::Logger::Logg(C_ERROR, PVT_FMT(target(), "unable to lock %s!") % err._msg.c_str());
+                ret = ksFail;
+            }
+            break;
+        default:
+            ret = ksFail;
+        }
         break;
     
     default:
@@ -1670,7 +2407,6 @@ int Board::KhompPvt::commandHandler(CommandRequest &cmd)
 
 int Board::eventThread(void *void_evt)
 {
-    EventRequest evt(false);
     EventFifo * fifo = static_cast < ChanEventHandler * >(void_evt)->fifo();
     int devid = fifo->_device;
 
@@ -1678,18 +2414,21 @@ int Board::eventThread(void *void_evt)
     {
         DBG(FUNC, D("(d=%d) c") % devid);
 
+        /* handled in place, inside the fifo */
+        EventRequest * evt = NULL;
+
         while(1)
         {
             try
             {
-                evt = fifo->_buffer.consumer_start();
+                evt = &(fifo->_buffer.consumer_start());
                 break;
             }
             catch(...) //BufferEmpty & e
             {
                 DBG(FUNC, D("(d=%d) buffer empty") % devid);
 
-                fifo->_cond.wait();
+                fifo->wait();
 
                 if (fifo->_shutdown)
                     return 0;
@@ -1712,17 +2451,16 @@ int Board::eventThread(void *void_evt)
 
         DBG(FUNC, D("(d=%d) processing buffer...") % devid);
 
-        try
+        Board * brd = lookupBoard(devid);
+
+        if (!brd)
         {
-            if(board(devid)->eventHandler(evt.obj(), evt.event()) != ksSuccess)
-            {
-                DBG(FUNC, D("(d=%d) Error on event(%d)") % devid);
-            }
+            K::Logger::Logg(C_ERROR, D("invalid device on event '%s'") 
+                % Verbose::eventName(evt->event()->Code).c_str());
         }
-        catch (K3LAPI::invalid_device & invalid)
+        else if (brd->eventHandler(evt->obj(), evt->event()) != ksSuccess)
         {
-            K::Logger::Logg(C_ERROR, D("invalid device on event '%s'") 
-                % Verbose::eventName(evt.event()->Code).c_str());
+            DBG(FUNC, D("(d=%d) Error on event(%d)") % devid);
         }
 
         fifo->_buffer.consumer_commit();
@@ -1746,7 +2484,7 @@ int Board::commandThread(void *void_evt)
         while (!fifo->_buffer.consume(cmd))
         {
             DBG(FUNC, D("(d=%d) Command buffer empty") % devid);
-            fifo->_cond.wait();
+            fifo->wait();
 
             if (fifo->_shutdown)
                 return 0;
@@ -1757,16 +2495,15 @@ int Board::commandThread(void *void_evt)
         DBG(FUNC, D("(d=%d) Command processing buffer...") % devid);
 
 
-        try
+        KhompPvt * pvt = lookup(devid, cmd.obj());
+
+        if (!pvt)
         {
-            if(get(devid, cmd.obj())->commandHandler(cmd) != ksSuccess)
-            {
-                DBG(FUNC, D("(d=%d) Error on command(%d)") % devid % cmd.code());
-            }
+            K::Logger::Logg(C_ERROR, OBJ_FMT(devid,cmd.obj(), "invalid device on command '%d'") %  cmd.code());
         }
-        catch (K3LAPI::invalid_channel & invalid)
+        else if (pvt->commandHandler(cmd) != ksSuccess)
         {
-            K::Logger::Logg(C_ERROR, OBJ_FMT(devid,cmd.obj(), "invalid device on command '%d'") %  cmd.code());
+            DBG(FUNC, D("(d=%d) Error on command(%d)") % devid % cmd.code());
         }
 
     }
@@ -1781,6 +2518,9 @@ extern "C" int32 Kstdcall khomp_event_callback(int32 obj, K3L_EVENT * e)
 {
     DBG(FUNC, D("%s") % Globals::verbose.event(obj, e).c_str());
 
+    if (ShmExport::enabled())
+        ShmExport::event(obj, e);
+
     switch(e->Code)
     {
     case EV_HARDWARE_FAIL:
@@ -1788,14 +2528,25 @@ extern "C" int32 Kstdcall khomp_event_callback(int32 obj, K3L_EVENT * e)
     case EV_CLIENT_RECONNECT:
     case EV_CLIENT_BUFFERED_AUDIOLISTENER_OVERFLOW:
         DBG(FUNC, D("Audio client buffered overflow"));
+        Supervisor::listenerOverflow();
         break;
     case EV_CLIENT_AUDIOLISTENER_TIMEOUT:
         K::Logger::Logg(C_ERROR,"Timeout on audio listener, registering audio listener again");
         k3lRegisterAudioListener( NULL, khomp_audio_listener );
+        Supervisor::listenerTimeout();
         break;
     default:
+        Board * board = Board::lookupBoard(e->DeviceId);
+
+        if (!board)
+        {
+            K::Logger::Logg(C_ERROR, D("invalid device %d on event '%s'")
+                % e->DeviceId % Verbose::eventName(e->Code).c_str());
+            break;
+        }
+
         EventRequest e_req(obj, e);
-        Board::board(e->DeviceId)->chanEventHandler()->write(e_req);
+        board->chanEventHandler()->write(e_req);
         break;
     }
 
@@ -0,0 +1,247 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <atomic.hpp>
+
+#include "media.h"
+#include "opt.h"
+#include "defs.h"
+#include "logger.h"
+
+MediaTick::SliceVector MediaTick::_slices;
+volatile bool          MediaTick::_shutdown = false;
+
+/* per-packet work on the reader side, done by the media thread */
+struct InputStage
+{
+    InputStage(const unsigned char * gain): _gain(gain) {};
+
+    void operator()(char * data, unsigned int size)
+    {
+        if (_gain)
+            G711::apply(_gain, data, data, size);
+    }
+
+    const unsigned char * _gain;
+};
+
+MediaTick::Slice::Slice(unsigned int index)
+: _index(index), _cond(Globals::module_pool), _thread(NULL), _pending(0), _ticks(0), _idle(0), _wait_max(0)
+{};
+
+MediaTick::Slice::~Slice()
+{
+    delete _thread;
+}
+
+bool MediaTick::initialize(void)
+{
+    _shutdown = false;
+
+    if (!Opt::_media_threads)
+        return true;
+
+    std::vector < Board::KhompPvt * > pvts;
+
+    for (unsigned int dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+    {
+        for (unsigned int obj = 0; obj < Globals::k3lapi.channel_count(dev); obj++)
+        {
+            Board::KhompPvt * pvt = Board::lookup(dev, obj);
+
+            if (pvt)
+                pvts.push_back(pvt);
+        }
+    }
+
+    if (pvts.empty())
+        return true;
+
+    const unsigned int threads = std::min((unsigned int)pvts.size(), Opt::_media_threads);
+    const unsigned int size    = (pvts.size() + threads - 1) / threads;
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        Slice * slice = new Slice(i);
+
+        const unsigned int first = i * size;
+        const unsigned int last  = std::min((unsigned int)pvts.size(), first + size);
+
+        slice->_pvts.assign(pvts.begin() + first, pvts.begin() + last);
+
+        for (unsigned int j = first; j < last; j++)
+            pvts[j]->_media_slice = i;
+
+        _slices.push_back(slice);
+    }
+
+    for (SliceVector::iterator i = _slices.begin(); i != _slices.end(); i++)
+    {
+        Slice * slice = *i;
+
+        slice->_thread = new Thread(&MediaTick::worker, slice, Globals::module_pool);
+
+        if (!slice->_thread->start())
+        {
+            K::Logger::Logg(C_ERROR, "unable to start media threads, using per-channel audio processing.");
+
+            delete slice->_thread;
+            slice->_thread = NULL;
+
+            finalize();
+            return false;
+        }
+    }
+
+    K::Logger::Logg(C_MESSAGE, FMT("batched media processing: %d threads, %d channels each")
+        % _slices.size() % size);
+
+    return true;
+}
+
+void MediaTick::finalize(void)
+{
+    _shutdown = true;
+
+    for (SliceVector::iterator i = _slices.begin(); i != _slices.end(); i++)
+    {
+        Slice * slice = *i;
+
+        if (slice->_thread)
+        {
+            slice->_cond.signal();
+            slice->_thread->join();
+        }
+
+        DBG(FUNC, FMT("media thread %d: %d ticks, %d idle, %d ms worst wait") % slice->_index
+            % slice->_ticks % slice->_idle % slice->_wait_max);
+
+        delete slice;
+    }
+
+    _slices.clear();
+}
+
+int MediaTick::worker(Slice * slice)
+{
+#ifdef __linux__
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (cpus > 1)
+        {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(slice->_index % cpus, &set);
+
+            if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            {
+                DBG(FUNC, FMT("unable to pin media thread %d to cpu %d") % slice->_index % (slice->_index % cpus));
+            }
+        }
+    }
+#endif
+
+    while (!_shutdown)
+    {
+        /* woken up by arrivals; the period is only a fallback, so a *
+         * lost wake-up never delays packets more than one tick.    */
+        if (!slice->_cond.wait(Globals::boards_packet_duration))
+            ++slice->_idle;
+
+        if (_shutdown)
+            break;
+
+        /* arrivals from now on wake us up again */
+        uint32_t first = Atomic::doLoad(&slice->_pending);
+
+        while (!Atomic::doCAS(&slice->_pending, &first, 0u))
+            ;
+
+        if (first != 0)
+            slice->_wait_max = std::max(slice->_wait_max, FrameStorage::now_ms() - first);
+
+        tick(*slice);
+
+        ++slice->_ticks;
+    }
+
+    return 0;
+}
+
+void MediaTick::arrived(Board::KhompPvt * pvt)
+{
+    Slice * slice = _slices[pvt->_media_slice];
+
+    /* only the first arrival since the last tick signals the thread */
+    const uint32_t stamp = std::max(FrameStorage::now_ms(), 1u);
+
+    if (Atomic::doCAS(&slice->_pending, 0u, stamp))
+        slice->_cond.signal();
+}
+
+void MediaTick::tick(Slice & slice)
+{
+    for (std::vector < Board::KhompPvt * >::iterator i = slice._pvts.begin(); i != slice._pvts.end(); i++)
+    {
+        Board::KhompPvt * pvt = *i;
+
+        if (!pvt->call()->_flags.check(Kflags::LISTEN_UP) || !pvt->_reader_frames.batched())
+            continue;
+
+        InputStage stage(pvt->inputGain());
+
+        if (pvt->_reader_frames.process(stage))
+            pvt->_reader_cond.signal();
+    }
+}
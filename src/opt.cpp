@@ -45,6 +45,7 @@
 #include "globals.h"
 #include "defs.h"
 #include "logger.h"
+#include "frame.h"
 
 bool                            Opt::_debug;
 std::string                     Opt::_dialplan;
@@ -122,6 +123,36 @@ std::string  Opt::_kommuter_activation;
 
 unsigned int Opt::_audio_packet_size;
 
+unsigned int Opt::_audio_buffer_length;
+std::string  Opt::_audio_buffer_policy;
+
+bool         Opt::_adaptive_playout;
+bool         Opt::_drift_compensation;
+unsigned int Opt::_reader_concealment;
+unsigned int Opt::_stream_buffer_packets;
+
+bool         Opt::_audio_memory_lock;
+bool         Opt::_audio_memory_hugepages;
+
+bool         Opt::_suppress_silence;
+unsigned int Opt::_silence_hangover;
+
+bool         Opt::_linear_audio;
+bool         Opt::_ulaw_audio;
+bool         Opt::_match_peer_codec;
+
+std::string  Opt::_record_format;
+
+unsigned int Opt::_audio_stall_timeout;
+
+unsigned int Opt::_media_threads;
+
+bool         Opt::_lazy_audio;
+unsigned int Opt::_audio_idle_timeout;
+
+std::string  Opt::_shm_export;
+unsigned int Opt::_shm_export_slots;
+
 void Opt::initialize(void) 
 { 
     Globals::options.add(ConfigOption("debug",    _debug,    false));
@@ -196,7 +227,47 @@ void Opt::initialize(void)
     Globals::options.add(ConfigOption("kommuter-timeout",    _kommuter_timeout ,(unsigned int) 10 , (unsigned int) 0 , (unsigned int) 255));
 
     Globals::options.add(ConfigOption("audio-packet-length", _audio_packet_size,
-         (unsigned int)KHOMP_READ_PACKET_SIZE, (unsigned int)KHOMP_MIN_READ_PACKET_SIZE, (unsigned int)KHOMP_MAX_READ_PACKET_SIZE, 8u));
+         Globals::switch_packet_size, (unsigned int)KHOMP_MIN_READ_PACKET_SIZE, (unsigned int)KHOMP_MAX_READ_PACKET_SIZE, 80u));
+
+    ConfigOption::string_allowed_type buffer_policy_allowed;
+    buffer_policy_allowed.insert("drop-newest");
+    buffer_policy_allowed.insert("drop-oldest");
+    buffer_policy_allowed.insert("compress-silence");
+
+    Globals::options.add(ConfigOption("audio-buffer-length", _audio_buffer_length,
+         (unsigned int)KHOMP_AUDIO_BUFFER_LENGTH, (unsigned int)KHOMP_MIN_AUDIO_BUFFER_LENGTH, (unsigned int)KHOMP_MAX_AUDIO_BUFFER_LENGTH));
+    Globals::options.add(ConfigOption("audio-buffer-policy", _audio_buffer_policy, "drop-newest", buffer_policy_allowed));
+
+    Globals::options.add(ConfigOption("adaptive-playout", _adaptive_playout, true));
+    Globals::options.add(ConfigOption("drift-compensation", _drift_compensation, true));
+    Globals::options.add(ConfigOption("reader-concealment", _reader_concealment, 60u, 0u, 500u));
+    Globals::options.add(ConfigOption("stream-buffer-packets", _stream_buffer_packets, 2u, 1u, (unsigned int)KHOMP_MAX_AUDIO_BUFFER_LENGTH));
+
+    Globals::options.add(ConfigOption("audio-memory-lock",      _audio_memory_lock,      true));
+    Globals::options.add(ConfigOption("audio-memory-hugepages", _audio_memory_hugepages, false));
+
+    Globals::options.add(ConfigOption("suppress-silence", _suppress_silence, false));
+    Globals::options.add(ConfigOption("silence-hangover", _silence_hangover, 240u, 0u, 2000u));
+
+    Globals::options.add(ConfigOption("linear-audio", _linear_audio, false));
+    Globals::options.add(ConfigOption("ulaw-audio", _ulaw_audio, false));
+    Globals::options.add(ConfigOption("match-peer-codec", _match_peer_codec, true));
+
+    ConfigOption::string_allowed_type record_format_allowed;
+    record_format_allowed.insert("wav");
+    record_format_allowed.insert("raw");
+
+    Globals::options.add(ConfigOption("record-format", _record_format, "wav", record_format_allowed));
+
+    Globals::options.add(ConfigOption("audio-stall-timeout", _audio_stall_timeout, 300u, 0u, 10000u));
+
+    Globals::options.add(ConfigOption("media-threads", _media_threads, 0u, 0u, 64u));
+
+    Globals::options.add(ConfigOption("lazy-audio", _lazy_audio, false));
+    Globals::options.add(ConfigOption("audio-idle-timeout", _audio_idle_timeout, 5000u, 0u, 600000u));
+
+    Globals::options.add(ConfigOption("shm-export", _shm_export, ""));
+    Globals::options.add(ConfigOption("shm-export-slots", _shm_export_slots, 8192u, 64u, 1048576u));
 
     Globals::options.add(ConfigOption("log-to-disk",    ProcessLogOptions(O_GENERIC), "standard", false));
     Globals::options.add(ConfigOption("log-to-console", ProcessLogOptions(O_CONSOLE), "standard", false));
@@ -280,11 +351,22 @@ void Opt::printConfiguration(switch_stream_handle_t* stream)
     for( std::map<std::string, CSpan>::iterator ii=_spans.begin(); ii!=_spans.end(); ++ii )
     {
         stream->write_function(stream,
-                               "Span: %s.\nDialplan: %s.\nContext: %s.\nDialstring: %s.\n\n",
+                               "Span: %s.\nDialplan: %s.\nContext: %s.\nDialstring: %s.\n",
                                (*ii).first.c_str(),
                                (*ii).second._dialplan.c_str(),
                                (*ii).second._context.c_str(),
                                (*ii).second._dialstring.c_str());
+
+        if (!(*ii).second._channels.empty())
+        {
+            stream->write_function(stream,
+                                   "Channels: %s.\nAudio buffer length: %u.\nAudio buffer policy: %s.\n",
+                                   (*ii).second._channels.c_str(),
+                                   ((*ii).second._audio_buffer_length ? (*ii).second._audio_buffer_length : _audio_buffer_length),
+                                   ((*ii).second._audio_buffer_policy.empty() ? _audio_buffer_policy : (*ii).second._audio_buffer_policy).c_str());
+        }
+
+        stream->write_function(stream, "\n");
     }
 }
 
@@ -1005,6 +1087,46 @@ void Opt::ProcessSpans(switch_xml_t &xml)
             {
                 tmp_span->_dialstring = val;
             }
+            else if (!strcmp("channels", var))
+            {
+                tmp_span->_channels = val;
+            }
+            else if (!strcmp("audio-buffer-length", var))
+            {
+                try
+                {
+                    unsigned long length = Strings::toulong(val);
+
+                    if (length < KHOMP_MIN_AUDIO_BUFFER_LENGTH || length > KHOMP_MAX_AUDIO_BUFFER_LENGTH)
+                    {
+                        K::Logger::Logg(C_ERROR,FMT("Option %s in span %s should be between %d and %d.")
+                        % var % span_id % KHOMP_MIN_AUDIO_BUFFER_LENGTH % KHOMP_MAX_AUDIO_BUFFER_LENGTH);
+                    }
+                    else
+                    {
+                        tmp_span->_audio_buffer_length = length;
+                    }
+                }
+                catch (Strings::invalid_value e)
+                {
+                    K::Logger::Logg(C_ERROR,FMT("Option %s in span %s: number expected, got '%s'.")
+                    % var % span_id % val);
+                }
+            }
+            else if (!strcmp("audio-buffer-policy", var))
+            {
+                FrameStorage::PolicyType policy;
+
+                if (!FrameStorage::policy_from_name(val, policy))
+                {
+                    K::Logger::Logg(C_ERROR,FMT("Option %s in span %s: unknown policy '%s'.")
+                    % var % span_id % val);
+                }
+                else
+                {
+                    tmp_span->_audio_buffer_policy = val;
+                }
+            }
             else
             {
                 K::Logger::Logg(C_ERROR,FMT("Option %s in span %s not valid.")
@@ -0,0 +1,222 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "playout.h"
+#include "g711.h"
+
+/* fixed point scale for depths */
+#define DEPTH_ONE        256
+
+/* smoothing of the depth: about 1s with 16ms ticks */
+#define DEPTH_SMOOTHING   64
+
+/* ticks playing before the reference depth is taken (~2s) */
+#define DEPTH_SETTLE     128
+
+/* how far the smoothed depth may drift before being corrected (packets) */
+#define DEPTH_DEADBAND   (DEPTH_ONE / 2)
+
+/* loudest a spot (4 samples, absolute linear sum) may be for stretching */
+#define STRETCH_QUIET   2048
+
+void Playout::reset(void)
+{
+    _buffering = true;
+
+    _last     = 0;
+    _estimate = 0;
+
+    Atomic::doStore(&_jitter, 0u);
+    Atomic::doStore(&_target, 1u);
+
+    _depth_avg = 0;
+    _depth_ref = -1;
+    _settle    = 0;
+    _pending   = 0;
+
+    _stats.clear();
+}
+
+void Playout::arrival(unsigned int duration)
+{
+    const switch_time_t now = switch_micro_time_now();
+
+    if (_last != 0)
+    {
+        /* difference between expected and real interarrival time */
+        const long long expected = (long long)duration * 1000;
+        const long long diff     = (now - _last) - expected;
+
+        /* long pauses (hold, silence suppression) are not jitter */
+        const int dev = (int)std::min(diff < 0 ? -diff : diff, 500000ll);
+
+        /* J = J + (|D| - J) / 16 */
+        _estimate = (unsigned int)((int)_estimate + (dev - (int)_estimate) / 16);
+    }
+
+    _last = now;
+
+    /* enough to hold one arriving packet, plus three times the jitter */
+    const unsigned int board = Globals::boards_packet_duration * 1000;
+
+    Atomic::doStore(&_jitter, _estimate);
+    Atomic::doStore(&_target, ((duration * 1000) + (3 * _estimate) + board - 1) / board);
+}
+
+Playout::ActionType Playout::tick(unsigned int depth, unsigned int capacity)
+{
+    _stats.depth_sum += depth;
+    _stats.depth_ticks++;
+
+    if (depth > _stats.depth_max)
+        _stats.depth_max = depth;
+
+    if (!_enabled)
+        return PO_PLAY;
+
+    const unsigned int target = std::max(1u, std::min(Atomic::doLoad(&_target), capacity > 1 ? capacity - 1 : 1));
+
+    if (_buffering)
+    {
+        if (depth < target)
+            return PO_WAIT;
+
+        _buffering = false;
+
+        /* start smoothing from the current depth */
+        _depth_avg = depth * DEPTH_ONE;
+        _depth_ref = -1;
+        _settle    = 0;
+        _pending   = 0;
+    }
+
+    if (_compensate)
+    {
+        /* A = A + (D - A) / 64 */
+        _depth_avg += ((int)(depth * DEPTH_ONE) - _depth_avg) / DEPTH_SMOOTHING;
+
+        if (_depth_ref < 0)
+        {
+            if (++_settle >= DEPTH_SETTLE)
+                _depth_ref = _depth_avg;
+        }
+        else if (_pending == 0)
+        {
+            /* one sample per tick, at most: far more than any clock drift */
+            if (_depth_avg > _depth_ref + DEPTH_DEADBAND)
+                _pending = -1;
+            else if (_depth_avg < _depth_ref - DEPTH_DEADBAND)
+                _pending = 1;
+        }
+    }
+
+    if (depth > target + 1)
+        return PO_SHRINK;
+
+    return PO_PLAY;
+}
+
+void Playout::corrected(void)
+{
+    if (_pending > 0)
+        ++_stats.inserted;
+    else if (_pending < 0)
+        ++_stats.deleted;
+
+    /* move the smoothed depth by what was corrected, so the next *
+     * correction only comes if drift persists.                   */
+    _depth_avg += (_pending * DEPTH_ONE) / (int)Globals::boards_packet_size;
+
+    _pending = 0;
+}
+
+unsigned int Playout::stretch(const char * in, unsigned int size, char * out, int delta)
+{
+    const unsigned char * src = (const unsigned char *)in;
+
+    if (size < 8 || delta == 0)
+        return 0;
+
+    /* find the quietest 4 samples (away from the packet edges) */
+    unsigned int best_pos    = 0;
+    int          best_energy = STRETCH_QUIET;
+
+    for (unsigned int i = 2; i + 4 <= size - 2; i++)
+    {
+        int energy = 0;
+
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            const int value = G711::decode(src[i + j]);
+            energy += (value < 0 ? -value : value);
+        }
+
+        if (energy < best_energy)
+        {
+            best_energy = energy;
+            best_pos    = i + 2;
+        }
+    }
+
+    if (best_pos == 0)
+        return 0;
+
+    if (delta > 0)
+    {
+        /* repeat the sample at the quiet spot */
+        memcpy(out, in, best_pos + 1);
+        memcpy(out + best_pos + 1, in + best_pos, size - best_pos);
+
+        return size + 1;
+    }
+
+    /* skip the sample at the quiet spot */
+    memcpy(out, in, best_pos);
+    memcpy(out + best_pos, in + best_pos + 1, size - best_pos - 1);
+
+    return size - 1;
+}
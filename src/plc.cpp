@@ -0,0 +1,230 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include <algorithm>
+
+#include "plc.h"
+#include "g711.h"
+#include "globals.h"
+
+static inline int16_t saturate(float value)
+{
+    if (value >  32767.0f) return  32767;
+    if (value < -32768.0f) return -32768;
+
+    return (int16_t)((value < 0.0f) ? (value - 0.5f) : (value + 0.5f));
+}
+
+void Concealer::reset(void)
+{
+    memset(_history, 0, sizeof(_history));
+
+    _primed  = false;
+    _pitch   = lag_min;
+    _offset  = 0;
+    _missing = 0;
+}
+
+void Concealer::remember(const int16_t * amp, unsigned int count)
+{
+    if (count >= history_len)
+    {
+        memcpy(_history, amp + count - history_len, sizeof(_history));
+        return;
+    }
+
+    memmove(_history, _history + count, (history_len - count) * sizeof(int16_t));
+    memcpy(_history + history_len - count, amp, count * sizeof(int16_t));
+}
+
+float Concealer::level(unsigned int missing)
+{
+    /* full level for the first 10ms, then fade out until the limit */
+    if (missing < full_len)
+        return 1.0f;
+
+    if (missing >= _limit)
+        return 0.0f;
+
+    return 1.0f - (float)(missing - full_len + 1) / (float)(_limit - full_len + 1);
+}
+
+unsigned int Concealer::find_pitch(void)
+{
+    /* compare the last 20ms against itself, 'lag' samples earlier */
+    const int16_t * last = _history + history_len - correlation;
+
+    unsigned int best     = lag_min;
+    unsigned long best_acc = ULONG_MAX;
+
+    for (unsigned int lag = lag_min; lag <= lag_max; lag++)
+    {
+        unsigned long acc = 0;
+
+        for (unsigned int j = 0; j < correlation && acc < best_acc; j++)
+            acc += abs((int)last[j] - (int)last[(int)j - (int)lag]);
+
+        if (acc < best_acc)
+        {
+            best_acc = acc;
+            best     = lag;
+        }
+    }
+
+    return best;
+}
+
+void Concealer::good(char * alaw, unsigned int count)
+{
+    if (!_limit || !count)
+        return;
+
+    int16_t amp[Globals::switch_packet_max_size];
+
+    count = std::min(count, (unsigned int)Globals::switch_packet_max_size);
+
+    G711::alaw_to_linear(alaw, amp, count);
+
+    if (_missing)
+    {
+        /* fade the synthetic signal out while the real one fades in */
+        unsigned int overlap = std::max(1u, _pitch >> 2);
+
+        if (overlap > count)
+            overlap = count;
+
+        const float fade = level(_missing);
+
+        const float step = 1.0f / overlap;
+
+        for (unsigned int i = 0; i < overlap; i++)
+        {
+            const float weight = (i + 1) * step;
+
+            amp[i] = saturate((1.0f - weight) * fade * _cycle[_offset] + weight * amp[i]);
+
+            if (++_offset >= _pitch)
+                _offset = 0;
+        }
+
+        /* only the smoothed samples have changed */
+        G711::linear_to_alaw(amp, alaw, overlap);
+
+        _missing = 0;
+    }
+
+    remember(amp, count);
+
+    _primed = true;
+}
+
+bool Concealer::conceal(char * alaw, unsigned int count)
+{
+    if (!_limit || !_primed || _missing >= _limit)
+        return false;
+
+    int16_t amp[Globals::switch_packet_max_size];
+
+    count = std::min(count, (unsigned int)Globals::switch_packet_max_size);
+
+    unsigned int i = 0;
+
+    if (_missing == 0)
+    {
+        _pitch = find_pitch();
+
+        const unsigned int overlap = std::max(1u, _pitch >> 2);
+
+        const int16_t * last   = _history + history_len - _pitch;
+        const int16_t * before = _history + history_len - 2 * _pitch;
+
+        /* one pitch period, its end blended with the period before *
+         * it, so the cycle loops around without a discontinuity.   */
+        for (unsigned int j = 0; j < _pitch - overlap; j++)
+            _cycle[j] = last[j];
+
+        for (unsigned int j = _pitch - overlap, k = 1; j < _pitch; j++, k++)
+        {
+            const float weight = (float)k / overlap;
+            _cycle[j] = (1.0f - weight) * last[j] + weight * before[j];
+        }
+
+        /* smooth the start into the real signal (reversed, so no delay is needed) */
+        for (; i < overlap && i < count; i++)
+        {
+            const float weight = (float)(i + 1) / overlap;
+
+            amp[i] = saturate((1.0f - weight) * _history[history_len - 1 - i] + weight * _cycle[i]);
+        }
+
+        _offset  = i % _pitch;
+        _missing = i;
+    }
+
+    for (; i < count; i++, _missing++)
+    {
+        const float fade = level(_missing);
+
+        if (fade <= 0.0f)
+        {
+            amp[i] = 0;
+            continue;
+        }
+
+        amp[i] = saturate(_cycle[_offset] * fade);
+
+        if (++_offset >= _pitch)
+            _offset = 0;
+    }
+
+    G711::linear_to_alaw(amp, alaw, count);
+
+    /* concealed audio is history as well, for longer gaps */
+    remember(amp, count);
+
+    return true;
+}
@@ -0,0 +1,553 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "recorder.h"
+#include "g711.h"
+#include "opt.h"
+#include "defs.h"
+#include "logger.h"
+
+/* how far apart both directions may get before the late one is padded */
+#define RECORD_PAD_LIMIT   8000
+
+/* writer thread period, in ms */
+#define RECORD_PERIOD       250
+
+#define WAV_HEADER_SIZE      44
+
+static const unsigned char alaw_silence = 0xD5;
+
+Recorder::TapVector Recorder::_taps;
+switch_mutex_t *    Recorder::_mutex    = NULL;
+SavedCondition *    Recorder::_cond     = NULL;
+Thread *            Recorder::_thread   = NULL;
+volatile bool       Recorder::_shutdown = false;
+
+RecordTap::RecordTap()
+: _active(false), _closing(false), _rx(NULL), _tx(NULL), _overflows(0), _header_errors(0),
+  _fd(-1), _wav(false), _written(0),
+  _blocks(NULL), _out_fill(0)
+{};
+
+RecordTap::~RecordTap()
+{
+    delete _rx;
+    delete _tx;
+
+    free(_blocks);
+}
+
+bool RecordTap::allocate(void)
+{
+    if (_blocks)
+        return true;
+
+    _rx = new SpscRingbuffer < char > (ring_size + 1);
+    _tx = new SpscRingbuffer < char > (ring_size + 1);
+
+    void * blocks = NULL;
+
+    if (posix_memalign(&blocks, getpagesize(), block_count * block_size) != 0)
+        return false;
+
+    _blocks = (char *)blocks;
+
+    return true;
+}
+
+void RecordTap::tx_silence(unsigned int size)
+{
+    if (!_active)
+        return;
+
+    /* written in place, no need for a silence buffer */
+    SpscRingbuffer < char >::Span spans[2];
+
+    if (_tx->write_spans(spans, size) < size)
+    {
+        ++_overflows;
+        return;
+    }
+
+    memset(spans[0].data, alaw_silence, spans[0].size);
+    memset(spans[1].data, alaw_silence, spans[1].size);
+
+    _tx->write_commit(size);
+}
+
+static void put16(char * p, unsigned int v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+}
+
+static void put32(char * p, unsigned long v)
+{
+    put16(p,     (unsigned int)(v & 0xffff));
+    put16(p + 2, (unsigned int)((v >> 16) & 0xffff));
+}
+
+/* mono, 8kHz, A-law (format 6) */
+static void wav_header(char * h, unsigned long data)
+{
+    memcpy(h, "RIFF", 4);
+    put32(h + 4, 36 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put32(h + 16, 16);
+    put16(h + 20, 6);
+    put16(h + 22, 1);
+    put32(h + 24, 8000);
+    put32(h + 28, 8000);
+    put16(h + 32, 1);
+    put16(h + 34, 8);
+    memcpy(h + 36, "data", 4);
+    put32(h + 40, data);
+}
+
+/* mixes both directions into one */
+static void mix(const char * a, const char * b, char * out, unsigned int count)
+{
+    /* other direction is missing: mix with silence */
+    if (!b)
+    {
+        const int pad = G711::decode(alaw_silence);
+
+        for (unsigned int i = 0; i < count; i++)
+        {
+            int value = G711::decode((unsigned char)a[i]) + pad;
+
+            if (value >  32767) value =  32767;
+            if (value < -32768) value = -32768;
+
+            out[i] = G711::encode((int16_t)value);
+        }
+
+        return;
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        int value = G711::decode((unsigned char)a[i]) + G711::decode((unsigned char)b[i]);
+
+        if (value >  32767) value =  32767;
+        if (value < -32768) value = -32768;
+
+        out[i] = G711::encode((int16_t)value);
+    }
+}
+
+bool Recorder::initialize(void)
+{
+    _shutdown = false;
+
+    switch_mutex_init(&_mutex, SWITCH_MUTEX_NESTED, Globals::module_pool);
+
+    _cond   = new SavedCondition(Globals::module_pool);
+    _thread = new Thread(&Recorder::writer, (void *)NULL, Globals::module_pool);
+
+    if (!_thread->start())
+    {
+        K::Logger::Logg(C_ERROR, "unable to start recording thread, recording disabled.");
+
+        delete _thread;
+        _thread = NULL;
+
+        return false;
+    }
+
+    return true;
+}
+
+void Recorder::finalize(void)
+{
+    if (_thread)
+    {
+        _shutdown = true;
+        _cond->signal();
+
+        _thread->join();
+
+        delete _thread;
+        _thread = NULL;
+    }
+
+    delete _cond;
+    _cond = NULL;
+
+    if (_mutex)
+    {
+        switch_mutex_destroy(_mutex);
+        _mutex = NULL;
+    }
+}
+
+std::string Recorder::filename(unsigned int device, unsigned int object, bool wav)
+{
+    char stamp[32];
+
+    time_t now = time(NULL);
+    struct tm tm_now;
+
+    localtime_r(&now, &tm_now);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_now);
+
+    std::string prefix(Opt::_record_prefix);
+
+    if (prefix.empty() || prefix[prefix.size() - 1] != '/')
+        prefix += "/";
+
+    return STG(FMT("%skhomp-b%02dc%02d-%s.%s") % prefix
+        % device % object % stamp % (wav ? "wav" : "alaw"));
+}
+
+bool Recorder::start(RecordTap & tap, std::string path, bool wav)
+{
+    if (!_thread || tap._active || tap._closing)
+        return false;
+
+    if (!tap.allocate())
+    {
+        K::Logger::Logg(C_ERROR, FMT("unable to allocate recording buffers for '%s'.") % path);
+        return false;
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        K::Logger::Logg(C_ERROR, FMT("unable to open recording file '%s': %s") % path % strerror(errno));
+        return false;
+    }
+
+    if (wav)
+    {
+        char header[WAV_HEADER_SIZE];
+        wav_header(header, 0);
+
+        if (::write(fd, header, sizeof(header)) != (ssize_t)sizeof(header))
+        {
+            K::Logger::Logg(C_ERROR, FMT("unable to write recording file '%s': %s") % path % strerror(errno));
+            ::close(fd);
+            return false;
+        }
+    }
+
+    tap._rx->clear();
+    tap._tx->clear();
+
+    tap._fd        = fd;
+    tap._wav       = wav;
+    tap._path      = path;
+    tap._written       = 0;
+    tap._overflows     = 0;
+    tap._header_errors = 0;
+    tap._out_fill  = 0;
+
+    switch_mutex_lock(_mutex);
+    _taps.push_back(&tap);
+    switch_mutex_unlock(_mutex);
+
+    /* audio may flow now */
+    tap._active = true;
+
+    DBG(FUNC, FMT("recording to '%s'") % path);
+
+    return true;
+}
+
+void Recorder::stop(RecordTap & tap)
+{
+    if (!tap._active)
+        return;
+
+    tap._active  = false;
+    tap._closing = true;
+
+    _cond->signal();
+}
+
+int Recorder::writer(void *)
+{
+    TapVector taps;
+
+    while (true)
+    {
+        const bool shutdown = _shutdown;
+
+        if (!shutdown)
+            _cond->wait(RECORD_PERIOD);
+
+        switch_mutex_lock(_mutex);
+        taps = _taps;
+        switch_mutex_unlock(_mutex);
+
+        for (TapVector::iterator i = taps.begin(); i != taps.end(); i++)
+        {
+            RecordTap & tap = *(*i);
+
+            if (shutdown)
+                tap._active = false;
+
+            const bool last = (shutdown || tap._closing);
+
+            drain(tap, last);
+
+            if (!last)
+                continue;
+
+            close(tap);
+
+            switch_mutex_lock(_mutex);
+            _taps.erase(std::find(_taps.begin(), _taps.end(), &tap));
+            switch_mutex_unlock(_mutex);
+        }
+
+        if (shutdown)
+            break;
+    }
+
+    return 0;
+}
+
+/* position 'offset' inside a pair of spans, and how much is contiguous from there */
+static const char * span_at(SpscRingbuffer < char >::Span * spans, unsigned int offset, unsigned int & size)
+{
+    if (offset < spans[0].size)
+    {
+        size = spans[0].size - offset;
+        return spans[0].data + offset;
+    }
+
+    offset -= spans[0].size;
+
+    size = spans[1].size - offset;
+    return spans[1].data + offset;
+}
+
+/* mixes straight from the rings into the output blocks ('b' may be NULL for silence) */
+void Recorder::output(RecordTap & tap, const char * a, const char * b, unsigned int count)
+{
+    const unsigned int space = RecordTap::block_count * RecordTap::block_size;
+
+    while (count != 0)
+    {
+        unsigned int amount = std::min(count, space - tap._out_fill);
+
+        mix(a, b, tap._blocks + tap._out_fill, amount);
+
+        tap._out_fill += amount;
+        count         -= amount;
+
+        a += amount;
+
+        if (b)
+            b += amount;
+
+        if (tap._out_fill == space)
+            flush(tap, false);
+    }
+}
+
+void Recorder::drain(RecordTap & tap, bool last)
+{
+    SpscRingbuffer < char >::Span rx[2];
+    SpscRingbuffer < char >::Span tx[2];
+
+    const unsigned int rx_total = tap._rx->read_spans(rx);
+    const unsigned int tx_total = tap._tx->read_spans(tx);
+
+    const unsigned int total = std::min(rx_total, tx_total);
+
+    unsigned int done = 0;
+
+    /* both directions: data is committed as soon as it is mixed */
+    while (done < total)
+    {
+        unsigned int rx_size = 0;
+        unsigned int tx_size = 0;
+
+        const char * a = span_at(rx, done, rx_size);
+        const char * b = span_at(tx, done, tx_size);
+
+        const unsigned int amount = std::min(total - done, std::min(rx_size, tx_size));
+
+        output(tap, a, b, amount);
+
+        tap._rx->read_commit(amount);
+        tap._tx->read_commit(amount);
+
+        done += amount;
+    }
+
+    /* one direction stopped (or got too late): pad it with silence */
+    SpscRingbuffer < char >::Span * spans = (rx_total > tx_total ? rx : tx);
+    SpscRingbuffer < char >       * ring  = (rx_total > tx_total ? tap._rx : tap._tx);
+
+    const unsigned int excess = std::max(rx_total, tx_total) - total;
+
+    if (last || excess > RECORD_PAD_LIMIT)
+    {
+        while (done < total + excess)
+        {
+            unsigned int size = 0;
+
+            const char * a = span_at(spans, done, size);
+
+            const unsigned int amount = std::min(total + excess - done, size);
+
+            output(tap, a, NULL, amount);
+
+            ring->read_commit(amount);
+
+            done += amount;
+        }
+    }
+
+    if (last || tap._out_fill >= RecordTap::block_size)
+        flush(tap, last);
+}
+
+bool Recorder::flush(RecordTap & tap, bool last)
+{
+    /* only whole blocks, unless closing */
+    const unsigned int amount = (last ? tap._out_fill :
+        (tap._out_fill / RecordTap::block_size) * RecordTap::block_size);
+
+    /* file is gone: throw audio away */
+    if (tap._fd < 0)
+    {
+        tap._out_fill = 0;
+        return false;
+    }
+
+    if (amount == 0)
+        return true;
+
+    struct iovec iov[RecordTap::block_count];
+
+    unsigned int count = 0;
+
+    for (unsigned int offset = 0; offset < amount; offset += RecordTap::block_size, count++)
+    {
+        iov[count].iov_base = (void *)(tap._blocks + offset);
+        iov[count].iov_len  = std::min(RecordTap::block_size, amount - offset);
+    }
+
+    ssize_t res = writev(tap._fd, iov, count);
+
+    if (res != (ssize_t)amount)
+    {
+        K::Logger::Logg(C_ERROR, FMT("unable to write recording file '%s': %s, recording stopped.")
+            % tap._path % (res < 0 ? strerror(errno) : "short write"));
+
+        /* stop feeding it; writer thread will close the file */
+        tap._active  = false;
+        tap._closing = true;
+
+        ::close(tap._fd);
+        tap._fd = -1;
+
+        return false;
+    }
+
+    memmove(tap._blocks, tap._blocks + amount, tap._out_fill - amount);
+
+    tap._out_fill -= amount;
+    tap._written  += amount;
+
+    /* keep the header valid, in case we never get to close the file */
+    if (tap._wav)
+    {
+        char header[WAV_HEADER_SIZE];
+        wav_header(header, tap._written);
+
+        if (pwrite(tap._fd, header, sizeof(header), 0) != (ssize_t)sizeof(header))
+        {
+            /* players take a stale header as a zero-length file; *
+             * complain once, and keep trying on the next blocks.  */
+            if (tap._header_errors++ == 0)
+            {
+                K::Logger::Logg(C_ERROR, FMT("unable to update header of recording file '%s': %s")
+                    % tap._path % strerror(errno));
+            }
+        }
+    }
+
+    return true;
+}
+
+void Recorder::close(RecordTap & tap)
+{
+    if (tap._fd >= 0)
+    {
+        flush(tap, true);
+
+        ::close(tap._fd);
+        tap._fd = -1;
+    }
+
+    if (tap._overflows)
+    {
+        K::Logger::Logg(C_WARNING, FMT("recording '%s' lost audio %d times (disk too slow?)")
+            % tap._path % tap._overflows);
+    }
+
+    if (tap._header_errors)
+    {
+        K::Logger::Logg(C_WARNING, FMT("recording '%s' header update failed %d times")
+            % tap._path % tap._header_errors);
+    }
+
+    DBG(FUNC, FMT("recording '%s' closed (%d bytes)") % tap._path % tap._written);
+
+    tap._closing = false;
+}
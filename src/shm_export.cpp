@@ -0,0 +1,165 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <string.h>
+
+#include "shm_export.h"
+#include "opt.h"
+#include "defs.h"
+#include "logger.h"
+
+ShmRingbuffer ShmExport::_ring;
+volatile bool ShmExport::_enabled = false;
+
+bool ShmExport::initialize(void)
+{
+    _enabled = false;
+
+    if (Opt::_shm_export.empty())
+        return true;
+
+    const std::string name = (Opt::_shm_export[0] == '/' ? Opt::_shm_export : "/" + Opt::_shm_export);
+
+    if (!_ring.create(name, sizeof(ShmRecord), Opt::_shm_export_slots))
+    {
+        K::Logger::Logg(C_ERROR, FMT("unable to export audio and events: %s.") % _ring.error());
+        return false;
+    }
+
+    DBG(FUNC, FMT("exporting audio and events on '%s' (%d slots)") % name % _ring.header()->capacity);
+
+    _enabled = true;
+
+    return true;
+}
+
+void ShmExport::finalize(void)
+{
+    _enabled = false;
+
+    _ring.close();
+}
+
+void ShmExport::audio(ShmRecord::Type type, int device, int object, const char * data, unsigned int size)
+{
+    const switch_time_t stamp = switch_micro_time_now();
+    const unsigned int   limit = ShmRecord::payload_size;
+
+    while (size != 0)
+    {
+        ShmRingbuffer::Slot * slot = _ring.provider_start();
+
+        if (!slot)
+            return;
+
+        ShmRecord * rec = (ShmRecord *)slot->data;
+
+        const unsigned int amount = (size < limit ? size : limit);
+
+        rec->stamp    = (uint64_t)stamp;
+        rec->type     = (uint16_t)type;
+        rec->device   = (uint16_t)device;
+        rec->object   = (uint16_t)object;
+        rec->size     = (uint16_t)amount;
+        rec->code     = 0;
+        rec->add_info = 0;
+
+        memcpy(rec->data, data, amount);
+
+        _ring.provider_commit(slot, sizeof(ShmRecord) - ShmRecord::payload_size + amount, (uint32_t)(stamp / 1000));
+
+        data += amount;
+        size -= amount;
+    }
+}
+
+void ShmExport::event(int object, K3L_EVENT * ev)
+{
+    const switch_time_t stamp = switch_micro_time_now();
+
+    ShmRingbuffer::Slot * slot = _ring.provider_start();
+
+    if (!slot)
+        return;
+
+    ShmRecord * rec = (ShmRecord *)slot->data;
+
+    unsigned int amount = 0;
+
+    if (ev->ParamSize > 0 && ev->Params)
+    {
+        amount = (unsigned int)ev->ParamSize;
+
+        if (amount > ShmRecord::payload_size)
+            amount = ShmRecord::payload_size;
+
+        memcpy(rec->data, ev->Params, amount);
+    }
+
+    rec->stamp    = (uint64_t)stamp;
+    rec->type     = (uint16_t)ShmRecord::SR_EVENT;
+    rec->device   = (uint16_t)ev->DeviceId;
+    rec->object   = (uint16_t)object;
+    rec->size     = (uint16_t)amount;
+    rec->code     = ev->Code;
+    rec->add_info = ev->AddInfo;
+
+    _ring.provider_commit(slot, sizeof(ShmRecord) - ShmRecord::payload_size + amount, (uint32_t)(stamp / 1000));
+}
+
+unsigned long ShmExport::exported(void)
+{
+    if (!_ring.opened())
+        return 0;
+
+    /* every claimed position is a record published (or being published) */
+    return Atomic::doLoad(&_ring.header()->enqueue);
+}
+
+unsigned long ShmExport::dropped(void)
+{
+    if (!_ring.opened())
+        return 0;
+
+    return Atomic::doLoad(&_ring.header()->dropped);
+}
@@ -532,6 +532,13 @@ static bool processCallChannelString(std::string & str, Board::KhompPvt *& pvt,
 	return ret;
 }
 
+bool process_channel_string (std::string str, SpecFunType & fun)
+{
+	SpecFlagsType flags = SPF_FIRST;
+
+	return (processSpecAtoms(str, flags, fun) != SPR_FAIL);
+}
+
 Board::KhompPvt * process_dial_string (const char *dial_charv, int *cause)
 {
     //TODO: NEED KHOMP LOG, INSTEAD SWITCH_LOG
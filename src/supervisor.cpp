@@ -0,0 +1,561 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+#include <algorithm>
+
+#include <atomic.hpp>
+
+#include "supervisor.h"
+#include "lock.h"
+#include "opt.h"
+#include "defs.h"
+#include "logger.h"
+
+Supervisor::IncidentVector   Supervisor::_open;
+Supervisor::IncidentVector   Supervisor::_history;
+unsigned long                Supervisor::_incidents[3] = { 0, 0, 0 };
+volatile unsigned long       Supervisor::_timeouts  = 0;
+volatile unsigned long       Supervisor::_overflows = 0;
+switch_mutex_t *             Supervisor::_mutex    = NULL;
+SavedCondition *             Supervisor::_cond     = NULL;
+Thread *                     Supervisor::_thread   = NULL;
+volatile bool                Supervisor::_shutdown = false;
+volatile bool                Supervisor::_overflow = false;
+
+bool Supervisor::initialize(void)
+{
+    _shutdown = false;
+    _overflow = false;
+
+    switch_mutex_init(&_mutex, SWITCH_MUTEX_NESTED, Globals::module_pool);
+
+    _cond = new SavedCondition(Globals::module_pool);
+
+    if (!Opt::_audio_stall_timeout)
+        DBG(FUNC, "audio listener supervision disabled");
+
+    if (!Opt::_audio_stall_timeout && !(Opt::_lazy_audio && Opt::_audio_idle_timeout))
+        return true;
+
+    _thread = new Thread(&Supervisor::supervisor, (void *)NULL, Globals::module_pool);
+
+    if (!_thread->start())
+    {
+        K::Logger::Logg(C_ERROR, "unable to start audio supervisor thread, stalls will not be recovered.");
+
+        delete _thread;
+        _thread = NULL;
+
+        return false;
+    }
+
+    return true;
+}
+
+void Supervisor::stop(void)
+{
+    _shutdown = true;
+
+    if (_thread)
+    {
+        _cond->signal();
+
+        _thread->join();
+
+        delete _thread;
+        _thread = NULL;
+    }
+}
+
+void Supervisor::finalize(void)
+{
+    stop();
+
+    delete _cond;
+    _cond = NULL;
+
+    if (_mutex)
+    {
+        switch_mutex_destroy(_mutex);
+        _mutex = NULL;
+    }
+}
+
+void Supervisor::listenerTimeout(void)
+{
+    Atomic::doAdd(&_timeouts);
+
+    /* the listener was registered again, check everything now */
+    if (_cond)
+        _cond->signal();
+}
+
+void Supervisor::listenerOverflow(void)
+{
+    Atomic::doAdd(&_overflows);
+
+    /* audio was lost somewhere: what is buffered is out of sync */
+    _overflow = true;
+
+    if (_cond)
+        _cond->signal();
+}
+
+void Supervisor::summary(Summary & s)
+{
+    switch_mutex_lock(_mutex);
+
+    for (unsigned int i = 0; i < 3; i++)
+        s.incidents[i] = _incidents[i];
+
+    s.open   = _open;
+    s.recent = _history;
+
+    switch_mutex_unlock(_mutex);
+
+    s.timeouts  = _timeouts;
+    s.overflows = _overflows;
+}
+
+const char * Supervisor::scopeName(ScopeType scope)
+{
+    switch (scope)
+    {
+        case SC_CHANNEL: return "channel";
+        case SC_BOARD:   return "board";
+        case SC_GLOBAL:  return "global";
+    }
+
+    return "<unknown>";
+}
+
+int Supervisor::supervisor(void *)
+{
+    /* check a few times per timeout, but not too often */
+    const unsigned int period = (Opt::_audio_stall_timeout ?
+        std::max(20u, std::min(100u, Opt::_audio_stall_timeout / 4)) : 100u);
+
+    const bool idling = (Opt::_lazy_audio && Opt::_audio_idle_timeout);
+
+    while (!_shutdown)
+    {
+        _cond->wait(period);
+
+        if (_shutdown)
+            break;
+
+        if (_overflow)
+        {
+            _overflow = false;
+            flushAll();
+        }
+
+        if (Opt::_audio_stall_timeout)
+            check();
+
+        if (idling)
+            idle();
+    }
+
+    return 0;
+}
+
+bool Supervisor::contains(const Incident & inc, Board::KhompPvt * pvt)
+{
+    switch (inc.scope)
+    {
+        case SC_GLOBAL:  return true;
+        case SC_BOARD:   return inc.device == pvt->target().device;
+        case SC_CHANNEL: return inc.device == pvt->target().device && inc.object == pvt->target().object;
+    }
+
+    return false;
+}
+
+bool Supervisor::covered(Board::KhompPvt * pvt, ScopeType scope)
+{
+    for (IncidentVector::iterator i = _open.begin(); i != _open.end(); i++)
+    {
+        if (i->scope >= scope && contains(*i, pvt))
+            return true;
+    }
+
+    return false;
+}
+
+void Supervisor::flushAll(void)
+{
+    for (unsigned int dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+    {
+        for (unsigned int obj = 0; obj < Globals::k3lapi.channel_count(dev); obj++)
+        {
+            Board::KhompPvt * pvt = Board::lookup(dev, obj);
+
+            if (!pvt || !pvt->call()->_flags.check(Kflags::LISTEN_UP))
+                continue;
+
+            pvt->_reader_flush = true;
+            pvt->_writer_flush = true;
+        }
+    }
+}
+
+void Supervisor::idle(void)
+{
+    const uint32_t now = FrameStorage::now_ms();
+
+    for (unsigned int dev = 0; dev < Globals::k3lapi.device_count(); dev++)
+    {
+        for (unsigned int obj = 0; obj < Globals::k3lapi.channel_count(dev); obj++)
+        {
+            Board::KhompPvt * pvt = Board::lookup(dev, obj);
+
+            if (!pvt || pvt->_stalled)
+                continue;
+
+            pvt->idle_audio(now, Opt::_audio_idle_timeout);
+        }
+    }
+}
+
+void Supervisor::check(void)
+{
+    const unsigned int devices = Globals::k3lapi.device_count();
+    const int32_t      timeout = (int32_t)Opt::_audio_stall_timeout;
+
+    uint32_t now = FrameStorage::now_ms();
+
+    /* channels found stalled on this check, by board */
+    std::vector < PvtVector > fresh(devices);
+
+    /* stalled channels that should be re-armed again */
+    PvtVector retry;
+
+    /* everything still stalled, to close recovered incidents */
+    PvtVector stalled;
+
+    std::vector < unsigned int > listening_board(devices, 0);
+    std::vector < unsigned int > stalled_board(devices, 0);
+
+    unsigned int listening = 0;
+
+    for (unsigned int dev = 0; dev < devices; dev++)
+    {
+        for (unsigned int obj = 0; obj < Globals::k3lapi.channel_count(dev); obj++)
+        {
+            Board::KhompPvt * pvt = Board::lookup(dev, obj);
+
+            if (!pvt)
+                continue;
+
+            if (!pvt->call()->_flags.check(Kflags::LISTEN_UP) ||
+                 pvt->call()->_flags.check(Kflags::NATIVE_BRIDGE))
+            {
+                /* call is gone, or audio is not passing through the host anymore */
+                if (pvt->_stalled)
+                    recovered(pvt, now);
+
+                continue;
+            }
+
+            ++listening;
+            ++listening_board[dev];
+
+            const uint32_t stamp = pvt->_listen_stamp;
+
+            if (pvt->_stalled)
+            {
+                /* audio arrived after the last re-arm */
+                if ((int32_t)(stamp - pvt->_stall_rearm) > 0)
+                {
+                    recovered(pvt, stamp);
+                    continue;
+                }
+
+                ++stalled_board[dev];
+                stalled.push_back(pvt);
+
+                if ((int32_t)(now - pvt->_stall_rearm) >= timeout)
+                    retry.push_back(pvt);
+
+                continue;
+            }
+
+            if ((int32_t)(now - stamp) < timeout)
+                continue;
+
+            pvt->_stalled     = true;
+            pvt->_stall_since = stamp;
+
+            ++pvt->_stalls;
+
+            ++stalled_board[dev];
+            stalled.push_back(pvt);
+
+            fresh[dev].push_back(pvt);
+        }
+    }
+
+    PvtVector rearm;
+
+    bool global = false;
+
+    switch_mutex_lock(_mutex);
+
+    /* everyone stopped at once: the listener itself is in trouble */
+    if (listening > 1 && stalled.size() == listening)
+    {
+        bool any_fresh = false;
+
+        for (unsigned int dev = 0; dev < devices; dev++)
+            any_fresh |= !fresh[dev].empty();
+
+        if (any_fresh && !covered(stalled.front(), SC_GLOBAL))
+        {
+            open(SC_GLOBAL, 0, stalled);
+            global = true;
+        }
+    }
+
+    for (unsigned int dev = 0; dev < devices; dev++)
+    {
+        if (fresh[dev].empty())
+            continue;
+
+        rearm.insert(rearm.end(), fresh[dev].begin(), fresh[dev].end());
+
+        if (global)
+            continue;
+
+        if (listening_board[dev] > 1 && stalled_board[dev] == listening_board[dev])
+        {
+            if (!covered(fresh[dev].front(), SC_BOARD))
+            {
+                PvtVector board;
+
+                for (PvtVector::iterator i = stalled.begin(); i != stalled.end(); i++)
+                {
+                    if ((*i)->target().device == dev)
+                        board.push_back(*i);
+                }
+
+                open(SC_BOARD, dev, board);
+            }
+
+            continue;
+        }
+
+        for (PvtVector::iterator i = fresh[dev].begin(); i != fresh[dev].end(); i++)
+        {
+            if (covered(*i, SC_CHANNEL))
+                continue;
+
+            PvtVector single(1, *i);
+            open(SC_CHANNEL, dev, single);
+        }
+    }
+
+    close(stalled, now);
+
+    switch_mutex_unlock(_mutex);
+
+    rearm.insert(rearm.end(), retry.begin(), retry.end());
+
+    if (!rearm.empty())
+        recover(rearm, global);
+}
+
+void Supervisor::open(ScopeType scope, unsigned int device, PvtVector & pvts)
+{
+    Incident inc;
+
+    inc.scope    = scope;
+    inc.device   = device;
+    inc.object   = (scope == SC_CHANNEL ? pvts.front()->target().object : 0);
+    inc.channels = pvts.size();
+    inc.start    = pvts.front()->_stall_since;
+    inc.end      = inc.start;
+    inc.rearms   = 0;
+
+    for (PvtVector::iterator i = pvts.begin(); i != pvts.end(); i++)
+    {
+        if ((int32_t)((*i)->_stall_since - inc.start) < 0)
+            inc.start = (*i)->_stall_since;
+    }
+
+    ++_incidents[scope];
+
+    _open.push_back(inc);
+
+    if (scope == SC_CHANNEL)
+    {
+        K::Logger::Logg(C_WARNING, OBJ_FMT(device, inc.object,
+            "audio listener stalled, re-arming audio."));
+    }
+    else if (scope == SC_BOARD)
+    {
+        K::Logger::Logg(C_WARNING, FMT("audio listener stalled on all %d channels of board %d, re-arming audio.")
+            % inc.channels % device);
+    }
+    else
+    {
+        K::Logger::Logg(C_WARNING, FMT("audio listener stalled on all %d channels, registering listener and re-arming audio.")
+            % inc.channels);
+    }
+}
+
+void Supervisor::recover(PvtVector & pvts, bool global)
+{
+    /* never bring the listener back while unloading */
+    if (_shutdown)
+        return;
+
+    if (global)
+        k3lRegisterAudioListener( NULL, khomp_audio_listener );
+
+    for (PvtVector::iterator i = pvts.begin(); i != pvts.end(); i++)
+    {
+        Board::KhompPvt * pvt = *i;
+
+        /* each buffer is flushed by its consumer */
+        pvt->_reader_flush = true;
+        pvt->_writer_flush = true;
+
+        pvt->_reader_cond.signal();
+
+        try
+        {
+            ScopedPvtLock lock(pvt);
+
+            if (!pvt->rearm_audio())
+            {
+                K::Logger::Logg(C_WARNING, PVT_FMT(pvt->target(), "unable to re-arm audio, will try again."));
+            }
+        }
+        catch (ScopedLockFailed & err)
+        {
+            K::Logger::Logg(C_ERROR, PVT_FMT(pvt->target(), "unable to lock %s!") % err._msg.c_str());
+        }
+
+        /* audio stamped after this is proof of recovery */
+        pvt->_stall_rearm = FrameStorage::now_ms();
+    }
+
+    switch_mutex_lock(_mutex);
+
+    for (IncidentVector::iterator inc = _open.begin(); inc != _open.end(); inc++)
+    {
+        for (PvtVector::iterator i = pvts.begin(); i != pvts.end(); i++)
+        {
+            if (contains(*inc, *i))
+            {
+                ++inc->rearms;
+                break;
+            }
+        }
+    }
+
+    switch_mutex_unlock(_mutex);
+}
+
+void Supervisor::recovered(Board::KhompPvt * pvt, uint32_t when)
+{
+    pvt->_stalled = false;
+
+    const uint32_t gap = when - pvt->_stall_since;
+
+    pvt->_stall_ms += gap;
+
+    DBG(STRM, PVT_FMT(pvt->target(), "audio listener back after %d ms") % gap);
+
+    switch_mutex_lock(_mutex);
+
+    for (IncidentVector::iterator inc = _open.begin(); inc != _open.end(); inc++)
+    {
+        if (contains(*inc, pvt) && (int32_t)(when - inc->end) > 0)
+            inc->end = when;
+    }
+
+    switch_mutex_unlock(_mutex);
+}
+
+void Supervisor::close(PvtVector & stalled, uint32_t now)
+{
+    IncidentVector::iterator inc = _open.begin();
+
+    while (inc != _open.end())
+    {
+        bool pending = false;
+
+        for (PvtVector::iterator i = stalled.begin(); i != stalled.end() && !pending; i++)
+            pending = contains(*inc, *i);
+
+        if (pending)
+        {
+            inc++;
+            continue;
+        }
+
+        /* no channel came back with audio: calls ended during the stall */
+        if (inc->end == inc->start)
+            inc->end = now;
+
+        if (inc->scope != SC_CHANNEL)
+        {
+            K::Logger::Logg(C_MESSAGE, FMT("audio listener %s stall recovered after %d ms (%d channels, %d re-arms).")
+                % scopeName(inc->scope) % inc->duration() % inc->channels % inc->rearms);
+        }
+        else
+        {
+            K::Logger::Logg(C_MESSAGE, OBJ_FMT(inc->device, inc->object,
+                "audio listener stall recovered after %d ms (%d re-arms).") % inc->duration() % inc->rearms);
+        }
+
+        if (_history.size() >= history_size)
+            _history.erase(_history.begin());
+
+        _history.push_back(*inc);
+
+        inc = _open.erase(inc);
+    }
+}
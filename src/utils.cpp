@@ -47,17 +47,22 @@
 
 bool ChanCommandHandler::writeNoSignal(const CommandRequest & cmd)
 {
-    _fifo->_mutex.lock();
-    bool status = _fifo->_buffer.provide(cmd);
-    _fifo->_mutex.unlock();
-    return status;
+    return _fifo->_buffer.provide(cmd);
 };
 
 bool ChanCommandHandler::write(const CommandRequest & cmd)
 {
     bool status = writeNoSignal(cmd);
 
-    if (status) signal();
+    if (status)
+    {
+        _fifo->notify();
+    }
+    else
+    {
+        K::Logger::Logg(C_ERROR, FMT("(d=%d) command queue full (%d slots, %d failures so far), command dropped!")
+            % _fifo->_device % _fifo->_buffer.capacity() % _fifo->_buffer.failures());
+    }
 
     return status;
 };
@@ -80,40 +85,100 @@ void ChanCommandHandler::unreference()
 };
 
 
-/* Event */
+/* Event parameters */
 
-bool ChanEventHandler::provide(const EventRequest & evt)
+char EventParamPool::_small[EventParamPool::small_count][EventParamPool::small_size];
+char EventParamPool::_large[EventParamPool::large_count][EventParamPool::large_size];
+
+volatile unsigned int  EventParamPool::_small_used = 0;
+volatile unsigned int  EventParamPool::_large_used =
+    (EventParamPool::large_count < 32 ? ~((1u << EventParamPool::large_count) - 1) : 0);
+
+volatile unsigned long EventParamPool::_pooled = 0;
+volatile unsigned long EventParamPool::_heap   = 0;
+
+char * EventParamPool::take(volatile unsigned int & used, char * base, unsigned int size)
 {
-    _fifo->_mutex.lock();
-    bool status = _fifo->_buffer.provide(evt);
-    _fifo->_mutex.unlock();
-    return status;
-};
+    unsigned int cache = Atomic::doLoad(&used);
 
-bool ChanEventHandler::writeNoSignal(const EventRequest & evt)
+    while (cache != ~0u)
+    {
+        const unsigned int index = __builtin_ctz(~cache);
+
+        if (Atomic::doCAS(&used, &cache, cache | (1u << index)))
+        {
+            Atomic::doAdd(&_pooled);
+            return base + (index * size);
+        }
+
+        /* 'cache' was updated with the current value */
+    }
+
+    return NULL;
+}
+
+char * EventParamPool::alloc(unsigned int size)
+{
+    char * block = NULL;
+
+    if (size <= small_size)
+        block = take(_small_used, &(_small[0][0]), small_size);
+
+    if (!block && size <= large_size)
+        block = take(_large_used, &(_large[0][0]), large_size);
+
+    if (block)
+        return block;
+
+    Atomic::doAdd(&_heap);
+    return (char *)malloc(size);
+}
+
+void EventParamPool::release(char * block)
 {
-    bool status = true;
-    _fifo->_mutex.lock();
+    char * small = &(_small[0][0]);
+    char * large = &(_large[0][0]);
 
-    try
+    if (block >= small && block < small + sizeof(_small))
     {
-        _fifo->_buffer.provider_start().mirror(evt);
-        _fifo->_buffer.provider_commit();
+        Atomic::doClear(&_small_used, 1u << ((block - small) / small_size));
     }
-    catch(...) //BufferFull & e
+    else if (block >= large && block < large + sizeof(_large))
     {
-        status = false;
+        Atomic::doClear(&_large_used, 1u << ((block - large) / large_size));
     }
+    else
+    {
+        free(block);
+    }
+}
 
-    _fifo->_mutex.unlock();
-    return status;
+/* Event */
+
+bool ChanEventHandler::provide(const EventRequest & evt)
+{
+    return _fifo->_buffer.provide(evt);
+};
+
+bool ChanEventHandler::writeNoSignal(const EventRequest & evt)
+{
+    /* copied straight into the slot, parameters included */
+    return _fifo->_buffer.emplace(evt);
 };
 
 bool ChanEventHandler::write(const EventRequest & evt)
 {
     bool status = writeNoSignal(evt);
 
-    if (status) signal();
+    if (status)
+    {
+        _fifo->notify();
+    }
+    else
+    {
+        K::Logger::Logg(C_ERROR, FMT("(d=%d) event queue full or out of memory (%d slots, %d failures so far), event dropped!")
+            % _fifo->_device % _fifo->_buffer.capacity() % _fifo->_buffer.failures());
+    }
 
     return status;
 };
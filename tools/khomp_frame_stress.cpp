@@ -0,0 +1,483 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+/* Stress test of the zero-copy hand-off used by FrameManager::pick().
+ *
+ *   khomp_frame_stress [-t seconds] [-n slots] [-m max] [-p cpu] [-c cpu] [-b cpu] [-y]
+ *       runs a provider and a consumer thread, pinned to cpus 'p' and 'c'
+ *       (0 and 1 by default), over a SpscRingbuffer of 'n' packets, for 't'
+ *       seconds. The provider fills packets as the audio listener does and,
+ *       when full, drops the oldest one (the "drop-oldest" policy, which is
+ *       the one racing with the consumer). The consumer works as read_frame
+ *       and pick(max) do: gives back the last packets, holds up to 'm' new
+ *       ones, checks them, spends a while "using" them, and checks them
+ *       again: any change means the provider wrote into a held packet.
+ *       With -y, the consumer also yields the cpu while holding packets,
+ *       so the provider gets to run then even if both share a core.
+ *       With -b, packets are processed in batched mode (see MediaTick):
+ *       a media thread, pinned to cpu 'b', walks the ring from a snapshot
+ *       and transforms unprocessed packets in place before flagging them,
+ *       while the consumer picks one packet at a time, leaving unprocessed
+ *       ones in place, and the provider never drops an unprocessed one.
+ *       Packets are also accounted for: every packet committed has to be
+ *       either picked, dropped by the provider or still in the ring.
+ *
+ * FrameManager itself needs freeswitch, so this drives the ring the same
+ * way it does (provider_start/provider_discard/provider_commit against
+ * consumer_hold/consumer_held/consumer_release/consumer_unhold, and
+ * snapshot for the media thread). Build with 'make tools';
+ * only depends on commons/spsc_ringbuffer.cpp.
+ */
+
+#include <sched.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <spsc_ringbuffer.hpp>
+
+/* same as Globals::boards_packet_size */
+static const unsigned int packet_size = 128;
+
+typedef unsigned char Packet[packet_size];
+
+typedef SpscRingbuffer < Packet > AudioBuffer;
+
+/* as FrameManager::SlotInfo */
+struct SlotInfo
+{
+    volatile bool processed;
+};
+
+static volatile bool running = true;
+
+struct Results
+{
+    Results(): packets(0), dropped(0), full(0), picked(0), held(0), torn(0), disorder(0), waiting(0), processed(0) {};
+
+    /* provider */
+    unsigned long packets;   /* packets committed */
+    unsigned long dropped;   /* oldest packets discarded to make room */
+    unsigned long full;      /* incoming packets dropped (oldest was held) */
+
+    /* consumer */
+    unsigned long picked;    /* picks that got something */
+    unsigned long held;      /* packets held */
+    unsigned long torn;      /* packets changed while held, or corrupt */
+    unsigned long disorder;  /* packets older than the ones picked before */
+    unsigned long waiting;   /* picks that found the oldest packet unprocessed */
+
+    /* media thread */
+    unsigned long processed; /* packets processed */
+};
+
+struct Context
+{
+    AudioBuffer * ring;
+    Packet      * buffer;
+    SlotInfo    * info;
+
+    int           provider_cpu;
+    int           consumer_cpu;
+    int           media_cpu;
+    unsigned int  max;
+    bool          yield;
+    bool          batched;
+
+    Results       provider;
+    Results       consumer;
+    Results       media;
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((unsigned long long)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+static bool pin(const char * name, int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    const int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if (res != 0)
+    {
+        fprintf(stderr, "%s: unable to pin to cpu %d: %s, running unpinned\n", name, cpu, strerror(res));
+        return false;
+    }
+
+    return true;
+}
+
+/* sequence number in the first 4 bytes, and a pattern derived from it */
+static void fill(Packet & p, uint32_t seq)
+{
+    memcpy(&p[0], &seq, sizeof(seq));
+
+    for (unsigned int i = sizeof(seq); i < packet_size; i++)
+        p[i] = (unsigned char)((seq * 31) + i);
+}
+
+/* what the media thread does to the pattern (the "input gain") */
+static const unsigned char gain_mask = 0x5a;
+
+static bool check(const Packet & p, uint32_t & seq, unsigned char mask = 0)
+{
+    memcpy(&seq, &p[0], sizeof(seq));
+
+    for (unsigned int i = sizeof(seq); i < packet_size; i++)
+    {
+        if (p[i] != (unsigned char)(((seq * 31) + i) ^ mask))
+            return false;
+    }
+
+    return true;
+}
+
+static inline unsigned int slot_of(Context & ctx, Packet & p)
+{
+    return &p - ctx.buffer;
+}
+
+static void * provider(void * arg)
+{
+    Context & ctx = *(Context *)arg;
+    Results & res = ctx.provider;
+
+    pin("provider", ctx.provider_cpu);
+
+    uint32_t seq = 0;
+
+    while (running)
+    {
+        Packet * p = NULL;
+
+        try
+        {
+            p = &(ctx.ring->provider_start());
+        }
+        catch (...) // AudioBuffer::BufferFull & e)
+        {
+            /* the media thread may be working on the oldest packet */
+            if (ctx.batched && !Atomic::doLoad(&(ctx.info[slot_of(ctx, ctx.ring->consumer_held())].processed)))
+            {
+                ++res.full;
+                ++seq;
+                continue;
+            }
+
+            /* drop-oldest, as FrameManager::provider_start() does */
+            if (ctx.ring->provider_discard())
+                ++res.dropped;
+
+            try
+            {
+                p = &(ctx.ring->provider_start());
+            }
+            catch (...) // AudioBuffer::BufferFull & e)
+            {
+                ++res.full;
+                ++seq;
+                continue;
+            }
+        }
+
+        fill(*p, seq++);
+
+        /* must be written before the packet is visible */
+        Atomic::doStore(&(ctx.info[slot_of(ctx, *p)].processed), !ctx.batched);
+
+        ctx.ring->provider_commit();
+
+        ++res.packets;
+    }
+
+    return NULL;
+}
+
+static void * consumer(void * arg)
+{
+    Context & ctx = *(Context *)arg;
+    Results & res = ctx.consumer;
+
+    pin("consumer", ctx.consumer_cpu);
+
+    uint32_t last  = 0;
+    bool     first = true;
+
+    while (running)
+    {
+        /* FrameManager::pick(): the previous frame is done with */
+        ctx.ring->consumer_release();
+
+        const unsigned int amount = ctx.ring->consumer_hold(ctx.batched ? 1 : ctx.max);
+
+        if (!amount)
+        {
+            if (ctx.yield)
+                sched_yield();
+
+            continue;
+        }
+
+        /* FrameManager::pick() in batched mode: not ready yet, leave it there */
+        if (ctx.batched && !Atomic::doLoad(&(ctx.info[slot_of(ctx, ctx.ring->consumer_held())].processed)))
+        {
+            ctx.ring->consumer_unhold();
+
+            ++res.waiting;
+
+            if (ctx.yield)
+                sched_yield();
+
+            continue;
+        }
+
+        ++res.picked;
+        res.held += amount;
+
+        Packet * held = &(ctx.ring->consumer_held());
+
+        const unsigned char mask = (ctx.batched ? gain_mask : 0);
+
+        uint32_t seqs[256];
+
+        for (unsigned int i = 0; i < amount; i++)
+        {
+            if (!check(held[i], seqs[i], mask))
+            {
+                ++res.torn;
+                continue;
+            }
+
+            if (!first && seqs[i] <= last)
+                ++res.disorder;
+
+            first = false;
+            last  = seqs[i];
+        }
+
+        /* the core encodes/writes the frame meanwhile: read it a few times */
+        unsigned int sum = 0;
+
+        for (unsigned int pass = 0; pass < 4; pass++)
+            for (unsigned int i = 0; i < amount; i++)
+                for (unsigned int j = 0; j < packet_size; j++)
+                    sum += ((volatile unsigned char *)held[i])[j];
+
+        __asm__ __volatile__("" : : "r"(sum) : "memory");
+
+        if (ctx.yield)
+            sched_yield();
+
+        /* still the same packets? */
+        for (unsigned int i = 0; i < amount; i++)
+        {
+            uint32_t seq = 0;
+
+            if (!check(held[i], seq, mask) || seq != seqs[i])
+                ++res.torn;
+        }
+    }
+
+    ctx.ring->consumer_release();
+
+    return NULL;
+}
+
+/* MediaTick::tick() over one channel: FrameManager::process() */
+static void * media(void * arg)
+{
+    Context & ctx = *(Context *)arg;
+    Results & res = ctx.media;
+
+    pin("media", ctx.media_cpu);
+
+    const unsigned int mask = ctx.ring->slots() - 1;
+
+    while (running)
+    {
+        unsigned int first = 0;
+
+        const unsigned int total = ctx.ring->snapshot(first);
+
+        for (unsigned int i = 0; i < total; i++)
+        {
+            const unsigned int index = (first + i) & mask;
+
+            if (Atomic::doLoad(&(ctx.info[index].processed)))
+                continue;
+
+            Packet & p = ctx.buffer[index];
+
+            for (unsigned int j = sizeof(uint32_t); j < packet_size; j++)
+                ((volatile unsigned char *)p)[j] ^= gain_mask;
+
+            /* the consumer may pick it from now on */
+            Atomic::doStore(&(ctx.info[index].processed), true);
+
+            ++res.processed;
+        }
+
+        if (ctx.yield || !total)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void usage(const char * prog)
+{
+    fprintf(stderr, "usage: %s [-t seconds] [-n slots] [-m max] [-p cpu] [-c cpu] [-b cpu] [-y]\n", prog);
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int seconds = 10;
+    unsigned int slots   = 4;
+
+    Context ctx;
+
+    ctx.provider_cpu = 0;
+    ctx.consumer_cpu = 1;
+    ctx.media_cpu    = 2;
+    ctx.max          = 1;
+    ctx.yield        = false;
+    ctx.batched      = false;
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:m:p:c:b:yh")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': seconds          = (unsigned int)atoi(optarg); break;
+            case 'n': slots            = (unsigned int)atoi(optarg); break;
+            case 'm': ctx.max          = (unsigned int)atoi(optarg); break;
+            case 'p': ctx.provider_cpu = atoi(optarg);               break;
+            case 'c': ctx.consumer_cpu = atoi(optarg);               break;
+            case 'b': ctx.media_cpu    = atoi(optarg);
+                      ctx.batched      = true;                       break;
+            case 'y': ctx.yield        = true;                       break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!seconds || slots < 2 || !ctx.max || ctx.max > 255)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ctx.buffer = new Packet[AudioBuffer::slots_for(slots)];
+    ctx.info   = new SlotInfo[AudioBuffer::slots_for(slots)];
+    ctx.ring   = new AudioBuffer(slots, ctx.buffer);
+
+    if (ctx.batched)
+        printf("%u slots (%u usable), batched, provider on cpu %d, consumer on cpu %d, media on cpu %d, %u cpus online\n",
+            ctx.ring->slots(), slots - 1, ctx.provider_cpu, ctx.consumer_cpu, ctx.media_cpu,
+            (unsigned int)sysconf(_SC_NPROCESSORS_ONLN));
+    else
+        printf("%u slots (%u usable), holding up to %u, provider on cpu %d, consumer on cpu %d, %u cpus online\n",
+            ctx.ring->slots(), slots - 1, ctx.max, ctx.provider_cpu, ctx.consumer_cpu,
+            (unsigned int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    pthread_t threads[3];
+
+    const unsigned long long start = now_ns();
+
+    pthread_create(&threads[0], NULL, &consumer, &ctx);
+    pthread_create(&threads[1], NULL, &provider, &ctx);
+
+    if (ctx.batched)
+        pthread_create(&threads[2], NULL, &media, &ctx);
+
+    sleep(seconds);
+
+    running = false;
+
+    if (ctx.batched)
+        pthread_join(threads[2], NULL);
+
+    pthread_join(threads[1], NULL);
+    pthread_join(threads[0], NULL);
+
+    const double elapsed = (double)(now_ns() - start) / 1000000000.0;
+
+    const Results & p = ctx.provider;
+    const Results & c = ctx.consumer;
+
+    printf("provider: %lu packets (%.0f/s), %lu oldest dropped, %lu newest dropped (oldest held or unprocessed)\n",
+        p.packets, (double)p.packets / elapsed, p.dropped, p.full);
+
+    printf("consumer: %lu picks, %lu packets held, %lu torn, %lu out of order\n",
+        c.picked, c.held, c.torn, c.disorder);
+
+    if (ctx.batched)
+        printf("media: %lu packets processed, %lu picks found the oldest unprocessed\n",
+            ctx.media.processed, c.waiting);
+
+    /* whatever was not picked nor dropped has to be still there */
+    const unsigned long remaining = ctx.ring->count();
+    const long          lost      = (long)p.packets - (long)(p.dropped + c.held + remaining);
+
+    printf("accounting: %lu packets still in the ring, %ld lost\n", remaining, lost);
+
+    delete ctx.ring;
+    delete[] ctx.info;
+    delete[] ctx.buffer;
+
+    return (c.torn || c.disorder || lost ? 1 : 0);
+}
@@ -0,0 +1,278 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+/* Microbenchmark of the A-law conversions used in linear (L16) mode.
+ *
+ *   khomp_g711_bench [-n packets] [-s samples]
+ *       converts 'n' packets of 's' samples each way, with:
+ *         - freeswitch:  the per-sample routines the core PCMA codec
+ *                        (src/switch_pcm.c) runs, from src/include/g711.h,
+ *                        reproduced below so this builds without the tree;
+ *         - table:       G711's scalar table conversions;
+ *         - avx2:        G711's vector conversions (if the CPU has AVX2);
+ *       and checks every version against the others on all inputs.
+ *
+ * Build with 'make tools'; only depends on src/g711.cpp.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "g711.h"
+
+/* freeswitch's src/include/g711.h (from spandsp) */
+namespace FreeSwitch
+{
+    static inline int top_bit(unsigned int bits)
+    {
+        return (bits == 0 ? -1 : 31 - __builtin_clz(bits));
+    }
+
+    static inline unsigned char linear_to_alaw(int linear)
+    {
+        int mask;
+        int seg;
+
+        if (linear >= 0)
+        {
+            mask = 0x55 | 0x80;
+        }
+        else
+        {
+            mask = 0x55;
+            linear = -linear - 8;
+        }
+
+        seg = top_bit(linear | 0xFF) - 7;
+
+        if (seg >= 8)
+        {
+            if (linear >= 0)
+                return (unsigned char)(0x7F ^ mask);
+
+            return (unsigned char)(0x00 ^ mask);
+        }
+
+        return (unsigned char)(((seg << 4) | ((linear >> ((seg) ? (seg + 3) : 4)) & 0x0F)) ^ mask);
+    }
+
+    static inline int16_t alaw_to_linear(unsigned char alaw)
+    {
+        int i;
+        int seg;
+
+        alaw ^= 0x55;
+        i = ((alaw & 0x0F) << 4);
+        seg = (((int) alaw & 0x70) >> 4);
+
+        if (seg)
+            i = (i + 0x108) << (seg - 1);
+        else
+            i += 8;
+
+        return (int16_t)((alaw & 0x80) ? i : -i);
+    }
+
+    /* what switch_g711a_encode/decode do with a frame */
+    static void encode(const int16_t * in, char * out, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            out[i] = (char)linear_to_alaw(in[i]);
+    }
+
+    static void decode(const char * in, int16_t * out, unsigned int count)
+    {
+        for (unsigned int i = 0; i < count; i++)
+            out[i] = alaw_to_linear((unsigned char)in[i]);
+    }
+};
+
+typedef void (*ToLinearType)(const char *, int16_t *, unsigned int);
+typedef void (*ToAlawType)(const int16_t *, char *, unsigned int);
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((unsigned long long)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+/* every code and every sample, through both conversions */
+static unsigned int verify(const char * name, ToLinearType to_linear, ToAlawType to_alaw)
+{
+    char    codes[256 + 7];
+    int16_t linear[256 + 7];
+    int16_t expected_linear[256 + 7];
+
+    for (unsigned int i = 0; i < sizeof(codes); i++)
+        codes[i] = (char)i;
+
+    FreeSwitch::decode(codes, expected_linear, sizeof(codes));
+    to_linear(codes, linear, sizeof(codes));
+
+    unsigned int errors = 0;
+
+    for (unsigned int i = 0; i < sizeof(codes); i++)
+        errors += (linear[i] != expected_linear[i] ? 1 : 0);
+
+    int16_t * samples  = new int16_t[65536 + 15];
+    char    * alaw     = new char[65536 + 15];
+    char    * expected = new char[65536 + 15];
+
+    for (unsigned int i = 0; i < 65536 + 15; i++)
+        samples[i] = (int16_t)i;
+
+    /* the reference is G711's own table, which follows Sun's g711.c */
+    G711::linear_to_alaw_table(samples, expected, 65536 + 15);
+    to_alaw(samples, alaw, 65536 + 15);
+
+    for (unsigned int i = 0; i < 65536 + 15; i++)
+        errors += (alaw[i] != expected[i] ? 1 : 0);
+
+    delete[] samples;
+    delete[] alaw;
+    delete[] expected;
+
+    if (errors)
+        printf("%-10s %u conversion(s) differ!\n", name, errors);
+
+    return errors;
+}
+
+static void run(const char * name, ToLinearType to_linear, ToAlawType to_alaw,
+                unsigned long packets, unsigned int samples)
+{
+    char    * alaw   = new char[samples];
+    int16_t * linear = new int16_t[samples];
+
+    srand(1);
+
+    for (unsigned int i = 0; i < samples; i++)
+        linear[i] = (int16_t)(rand() - (RAND_MAX / 2));
+
+    unsigned long long start = now_ns();
+
+    for (unsigned long p = 0; p < packets; p++)
+    {
+        to_alaw(linear, alaw, samples);
+        __asm__ __volatile__("" : : "r"(alaw) : "memory");
+    }
+
+    const unsigned long long encoding = now_ns() - start;
+
+    start = now_ns();
+
+    for (unsigned long p = 0; p < packets; p++)
+    {
+        to_linear(alaw, linear, samples);
+        __asm__ __volatile__("" : : "r"(linear) : "memory");
+    }
+
+    const unsigned long long decoding = now_ns() - start;
+
+    const double total = (double)packets * samples;
+
+    printf("%-10s encode %7.3f ns/sample %9.1f ns/packet   decode %7.3f ns/sample %9.1f ns/packet\n", name,
+        (double)encoding / total, (double)encoding / packets,
+        (double)decoding / total, (double)decoding / packets);
+
+    delete[] alaw;
+    delete[] linear;
+}
+
+static void usage(const char * prog)
+{
+    fprintf(stderr, "usage: %s [-n packets] [-s samples]\n", prog);
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned long packets = 1000000;
+    unsigned int  samples = 160;
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': packets = strtoul(optarg, NULL, 10);  break;
+            case 's': samples = (unsigned int)atoi(optarg); break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!packets || !samples)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    G711::initialize();
+
+    unsigned int errors = 0;
+
+    errors += verify("table", &G711::alaw_to_linear_table, &G711::linear_to_alaw_table);
+
+    if (G711::vectorized())
+        errors += verify("avx2", &G711::alaw_to_linear_avx2, &G711::linear_to_alaw_avx2);
+
+    printf("%lu packets of %u samples\n", packets, samples);
+
+    run("freeswitch", &FreeSwitch::decode, &FreeSwitch::encode, packets, samples);
+    run("table", &G711::alaw_to_linear_table, &G711::linear_to_alaw_table, packets, samples);
+
+    if (G711::vectorized())
+        run("avx2", &G711::alaw_to_linear_avx2, &G711::linear_to_alaw_avx2, packets, samples);
+    else
+        printf("%-10s not supported by this CPU\n", "avx2");
+
+    return (errors ? 1 : 0);
+}
@@ -0,0 +1,319 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+/* Microbenchmark of the channel lookup done on every audio packet.
+ *
+ *   khomp_lookup_bench [-d devices] [-c channels] [-n lookups] [-i percent]
+ *       compares Board::lookup() (bounds check and one load from the dense
+ *       table) against Board::get() (K3LAPI::valid_channel(), then
+ *       std::vector::at() on the boards and on the channels, each wrapped in
+ *       try/catch), for a random sequence of 'n' (device, object) pairs with
+ *       'percent' of them out of range.
+ *
+ * Board::lookup() only forwards to the ChannelTable it keeps, which is used
+ * here straight from include/channel_table.h. Board::get() is the old path:
+ * the module needs freeswitch and K3L to link, so K3LAPI and Board are cut
+ * down to the members it uses, with the same code as include/khomp_pvt.h
+ * and commons/k3lapi.hpp. Build with 'make tools'.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "channel_table.h"
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((unsigned long long)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+struct KhompPvt
+{
+    KhompPvt(unsigned int d, unsigned int o): _device(d), _object(o) {};
+
+    unsigned int _device;
+    unsigned int _object;
+};
+
+/* what K3LAPI keeps for valid_channel() */
+struct K3LAPI
+{
+    struct invalid_channel
+    {
+        invalid_channel(int d, int o): device(d), object(o) {};
+        int device, object;
+    };
+
+    struct invalid_device
+    {
+        invalid_device(int d): device(d) {};
+        int device;
+    };
+
+    bool valid_channel(int dev, int obj)
+    {
+        return (dev >= 0 && dev < (int)_device_count && obj >= 0 && obj < (int)_channel_count[dev]);
+    }
+
+    unsigned int   _device_count;
+    unsigned int * _channel_count;
+};
+
+static K3LAPI k3lapi;
+
+struct Board
+{
+    typedef std::vector< Board * >    VectorBoard;
+    typedef std::vector< KhompPvt * > VectorChannel;
+
+    KhompPvt * channel(int obj)
+    {
+        return _channels.at(obj);
+    }
+
+    static Board * board(int dev)
+    {
+        try
+        {
+            return _boards.at(dev);
+        }
+        catch(...)
+        {
+            throw K3LAPI::invalid_device(dev);
+        }
+    }
+
+    static KhompPvt * get(int device, int object)
+    {
+        if (!k3lapi.valid_channel(device, object))
+            throw K3LAPI::invalid_channel(device, object);
+
+        try
+        {
+            return board(device)->channel(object);
+        }
+        catch(...)
+        {
+            throw K3LAPI::invalid_channel(device, object);
+        }
+    }
+
+    /* as in include/khomp_pvt.h */
+    static KhompPvt * lookup(unsigned int device, unsigned int object)
+    {
+        return _pvt_table.lookup(device, object);
+    }
+
+    VectorChannel _channels;
+
+    static VectorBoard               _boards;
+    static ChannelTable < KhompPvt > _pvt_table;
+};
+
+Board::VectorBoard        Board::_boards;
+ChannelTable < KhompPvt > Board::_pvt_table;
+
+static void build(unsigned int devices, unsigned int channels)
+{
+    k3lapi._device_count  = devices;
+    k3lapi._channel_count = new unsigned int[devices];
+
+    Board::_pvt_table.initialize(devices, channels);
+
+    for (unsigned int dev = 0; dev < devices; dev++)
+    {
+        Board * board = new Board();
+
+        k3lapi._channel_count[dev] = channels;
+
+        for (unsigned int obj = 0; obj < channels; obj++)
+        {
+            KhompPvt * pvt = new KhompPvt(dev, obj);
+
+            board->_channels.push_back(pvt);
+            Board::_pvt_table.set(dev, obj, pvt);
+        }
+
+        Board::_boards.push_back(board);
+    }
+}
+
+/* the same pairs are fed to both versions, so they do the same work */
+struct Pair
+{
+    unsigned int device;
+    unsigned int object;
+};
+
+static unsigned long run_lookup(const Pair * pairs, unsigned long count, unsigned long & found)
+{
+    unsigned long sum = 0;
+
+    for (unsigned long i = 0; i < count; i++)
+    {
+        KhompPvt * pvt = Board::lookup(pairs[i].device, pairs[i].object);
+
+        if (!pvt)
+            continue;
+
+        sum += pvt->_object;
+        ++found;
+    }
+
+    return sum;
+}
+
+static unsigned long run_get(const Pair * pairs, unsigned long count, unsigned long & found)
+{
+    unsigned long sum = 0;
+
+    for (unsigned long i = 0; i < count; i++)
+    {
+        try
+        {
+            KhompPvt * pvt = Board::get(pairs[i].device, pairs[i].object);
+
+            sum += pvt->_object;
+            ++found;
+        }
+        catch (K3LAPI::invalid_channel & err)
+        {
+            continue;
+        }
+    }
+
+    return sum;
+}
+
+static void report(const char * name, unsigned long long elapsed, unsigned long count, unsigned long found)
+{
+    printf("%-8s %10.2f ns/lookup  (%lu found, %lu invalid)\n", name,
+        (double)elapsed / (double)count, found, count - found);
+}
+
+static void usage(const char * prog)
+{
+    fprintf(stderr, "usage: %s [-d devices] [-c channels] [-n lookups] [-i percent]\n", prog);
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned int  devices  = 4;
+    unsigned int  channels = 60;
+    unsigned long count    = 10000000;
+    unsigned int  invalid  = 0;
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:c:n:i:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': devices  = (unsigned int)atoi(optarg);     break;
+            case 'c': channels = (unsigned int)atoi(optarg);     break;
+            case 'n': count    = strtoul(optarg, NULL, 10);      break;
+            case 'i': invalid  = (unsigned int)atoi(optarg);     break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!devices || !channels || !count || invalid > 100)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    build(devices, channels);
+
+    Pair * pairs = new Pair[count];
+
+    srand(1);
+
+    for (unsigned long i = 0; i < count; i++)
+    {
+        const bool bad = ((unsigned int)(rand() % 100) < invalid);
+
+        pairs[i].device = rand() % devices;
+        pairs[i].object = (bad ? channels + (rand() % 16) : rand() % channels);
+    }
+
+    unsigned long found_lookup = 0;
+    unsigned long found_get    = 0;
+
+    /* warm up the caches and the branch predictors on both */
+    run_lookup(pairs, std::min(count, 100000ul), found_lookup);
+    run_get(pairs, std::min(count, 100000ul), found_get);
+
+    found_lookup = found_get = 0;
+
+    unsigned long long start = now_ns();
+    const unsigned long sum_lookup = run_lookup(pairs, count, found_lookup);
+    const unsigned long long elapsed_lookup = now_ns() - start;
+
+    start = now_ns();
+    const unsigned long sum_get = run_get(pairs, count, found_get);
+    const unsigned long long elapsed_get = now_ns() - start;
+
+    printf("%u devices x %u channels, %lu lookups, %u%% invalid\n", devices, channels, count, invalid);
+
+    report("lookup()", elapsed_lookup, count, found_lookup);
+    report("get()",    elapsed_get,    count, found_get);
+
+    printf("speedup  %10.2fx\n", (double)elapsed_get / (double)elapsed_lookup);
+
+    delete[] pairs;
+
+    /* both must have seen exactly the same channels */
+    return (sum_lookup == sum_get && found_lookup == found_get ? 0 : 1);
+}
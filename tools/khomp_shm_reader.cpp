@@ -0,0 +1,476 @@
+/*******************************************************************************
+
+    KHOMP generic endpoint/channel library.
+    Copyright (C) 2007-2010 Khomp Ind. & Com.
+
+  The contents of this file are subject to the Mozilla Public License 
+  Version 1.1 (the "License"); you may not use this file except in compliance 
+  with the License. You may obtain a copy of the License at 
+  http://www.mozilla.org/MPL/ 
+
+  Software distributed under the License is distributed on an "AS IS" basis,
+  WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License for
+  the specific language governing rights and limitations under the License.
+
+  Alternatively, the contents of this file may be used under the terms of the
+  "GNU Lesser General Public License 2.1" license (the “LGPL" License), in which
+  case the provisions of "LGPL License" are applicable instead of those above.
+
+  If you wish to allow use of your version of this file only under the terms of
+  the LGPL License and not to allow others to use your version of this file 
+  under the MPL, indicate your decision by deleting the provisions above and 
+  replace them with the notice and other provisions required by the LGPL 
+  License. If you do not delete the provisions above, a recipient may use your 
+  version of this file under either the MPL or the LGPL License.
+
+  The LGPL header follows below:
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this library; if not, write to the Free Software Foundation, 
+    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+*******************************************************************************/
+
+/* Standalone reader for the "shm-export" segment of mod_khomp.
+ *
+ *   khomp_shm_reader [-s segment] [-a] [-c bNcM -w prefix]
+ *       prints the K3L events (and, with -a, every audio record) as they
+ *       come, plus audio and drop statistics each second; with -c/-w, the
+ *       audio of one channel is also written to prefix.rx and prefix.tx
+ *       (raw A-law). Waits for mod_khomp if it is not running, and attaches
+ *       again when it restarts.
+ *
+ *   khomp_shm_reader -b records [-p producers] [-n slots]
+ *       benchmark: forks a producer process publishing 'records' audio
+ *       records (from 'producers' threads) on a private segment, and
+ *       measures the cross-process throughput seen by this reader.
+ *
+ * Build with 'make tools'; only depends on commons/shm_ringbuffer.cpp.
+ */
+
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <string>
+#include <algorithm>
+
+#include <shm_ringbuffer.hpp>
+
+#include "shm_export.h"
+
+static volatile bool running = true;
+
+static void stop(int)
+{
+    running = false;
+}
+
+static uint64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+static void show_header(ShmRingbuffer & ring, const std::string & name)
+{
+    ShmRingbuffer::Header * h = ring.header();
+
+    fprintf(stderr, "attached to '%s': version %u, %u slots of %u bytes, producer pid %u (%s)\n",
+        name.c_str(), h->version, h->capacity, h->element_size, h->producer_pid,
+        (ring.producer_alive() ? "running" : "gone"));
+}
+
+static void show_record(const ShmRecord & rec)
+{
+    const time_t secs = (time_t)(rec.stamp / 1000000);
+
+    struct tm tm;
+    localtime_r(&secs, &tm);
+
+    printf("%02d:%02d:%02d.%03u b%02uc%02u ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+        (unsigned int)((rec.stamp / 1000) % 1000), rec.device, rec.object);
+
+    switch (rec.type)
+    {
+        case ShmRecord::SR_AUDIO_RX:
+        case ShmRecord::SR_AUDIO_TX:
+            printf("%s %u bytes\n", (rec.type == ShmRecord::SR_AUDIO_RX ? "rx" : "tx"), rec.size);
+            break;
+
+        case ShmRecord::SR_EVENT:
+        {
+            /* parameters are usually text, print only what is printable */
+            std::string params;
+
+            for (unsigned int i = 0; i < rec.size && rec.data[i]; i++)
+                params += ((rec.data[i] >= ' ' && rec.data[i] < 127) ? rec.data[i] : '.');
+
+            printf("event 0x%02x add_info=%d%s%s%s\n", rec.code, rec.add_info,
+                (params.empty() ? "" : " params='"), params.c_str(), (params.empty() ? "" : "'"));
+            break;
+        }
+
+        default:
+            printf("unknown record type %u\n", rec.type);
+            break;
+    }
+}
+
+static int read_loop(const std::string & name, bool all_audio, int device, int object, const std::string & prefix)
+{
+    FILE * rx = NULL;
+    FILE * tx = NULL;
+
+    if (!prefix.empty())
+    {
+        rx = fopen((prefix + ".rx").c_str(), "wb");
+        tx = fopen((prefix + ".tx").c_str(), "wb");
+
+        if (!rx || !tx)
+        {
+            fprintf(stderr, "unable to open '%s.rx'/'%s.tx' for writing\n", prefix.c_str(), prefix.c_str());
+            return 1;
+        }
+    }
+
+    ShmRingbuffer ring;
+
+    unsigned long records = 0;
+    unsigned long bytes   = 0;
+    unsigned long events  = 0;
+    uint32_t      dropped = 0;
+    uint64_t      last    = now_us();
+
+    while (running)
+    {
+        if (!ring.opened() || !ring.producer_alive())
+        {
+            /* producer is gone: drain what was left, then wait for a new one */
+            while (ring.opened() && ring.consumer_start())
+                ring.consumer_commit();
+
+            if (!ring.attach(name))
+            {
+                sleep(1);
+                continue;
+            }
+
+            show_header(ring, name);
+
+            dropped = ring.header()->dropped;
+            last    = now_us();
+        }
+
+        ShmRingbuffer::Slot * slot = ring.consumer_start();
+
+        if (slot)
+        {
+            const ShmRecord & rec = *(const ShmRecord *)slot->data;
+
+            if (rec.type == ShmRecord::SR_EVENT)
+            {
+                ++events;
+                show_record(rec);
+            }
+            else
+            {
+                ++records;
+                bytes += rec.size;
+
+                if (all_audio)
+                    show_record(rec);
+
+                if ((int)rec.device == device && (int)rec.object == object)
+                    fwrite(rec.data, 1, rec.size, (rec.type == ShmRecord::SR_AUDIO_RX ? rx : tx));
+            }
+
+            ring.consumer_commit();
+        }
+        else
+        {
+            usleep(1000);
+        }
+
+        const uint64_t now = now_us();
+
+        if (now - last >= 1000000)
+        {
+            const uint32_t total = ring.header()->dropped;
+
+            fprintf(stderr, "-- %lu audio records (%lu bytes), %lu events, %u dropped, %u waiting\n",
+                records, bytes, events, total - dropped, ring.count());
+
+            records = bytes = events = 0;
+            dropped = total;
+            last    = now;
+        }
+    }
+
+    if (rx) fclose(rx);
+    if (tx) fclose(tx);
+
+    return 0;
+}
+
+/***** BENCHMARK *****/
+
+struct BenchProducer
+{
+    ShmRingbuffer * ring;
+    unsigned long   first;
+    unsigned long   count;
+    unsigned long   retries;
+};
+
+static void * bench_producer(void * arg)
+{
+    BenchProducer * p = (BenchProducer *)arg;
+
+    for (unsigned long i = p->first; i < p->first + p->count; )
+    {
+        ShmRingbuffer::Slot * slot = p->ring->provider_start();
+
+        if (!slot)
+        {
+            /* the module drops instead; here we want every record across */
+            ++p->retries;
+            sched_yield();
+            continue;
+        }
+
+        ShmRecord * rec = (ShmRecord *)slot->data;
+
+        rec->stamp    = 0;
+        rec->type     = ShmRecord::SR_AUDIO_RX;
+        rec->device   = 0;
+        rec->object   = 0;
+        rec->size     = 160;
+        rec->code     = 0;
+        rec->add_info = (int32_t)i;
+
+        memset(rec->data, (int)(i & 0xff), 160);
+
+        p->ring->provider_commit(slot, sizeof(ShmRecord) - ShmRecord::payload_size + 160, 0);
+        ++i;
+    }
+
+    return NULL;
+}
+
+static int benchmark(unsigned long total, unsigned int producers, unsigned int slots)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/khomp-bench-%d", (int)getpid());
+
+    /* ready: producer to reader, go: reader to producer */
+    int ready[2];
+    int go[2];
+
+    if (pipe(ready) != 0 || pipe(go) != 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+
+    const pid_t child = fork();
+
+    if (child < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+
+    if (child == 0)
+    {
+        ShmRingbuffer ring;
+
+        char ok = (ring.create(name, sizeof(ShmRecord), slots) ? 1 : 0);
+
+        if (!ok)
+            fprintf(stderr, "%s\n", ring.error().c_str());
+
+        if (write(ready[1], &ok, 1) != 1 || !ok)
+            _exit(1);
+
+        /* wait for the reader to attach */
+        if (read(go[0], &ok, 1) != 1)
+            _exit(1);
+
+        BenchProducer * p = new BenchProducer[producers];
+        pthread_t     * t = new pthread_t[producers];
+
+        for (unsigned int i = 0; i < producers; i++)
+        {
+            p[i].ring    = &ring;
+            p[i].first   = (total / producers) * i;
+            p[i].count   = (i == producers - 1 ? total - p[i].first : total / producers);
+            p[i].retries = 0;
+
+            pthread_create(&t[i], NULL, bench_producer, &p[i]);
+        }
+
+        unsigned long retries = 0;
+
+        for (unsigned int i = 0; i < producers; i++)
+        {
+            pthread_join(t[i], NULL);
+            retries += p[i].retries;
+        }
+
+        fprintf(stderr, "producer: %lu retries on a full ring\n", retries);
+
+        /* keep the segment alive until the reader is done */
+        read(go[0], &ok, 1);
+
+        ring.close();
+        _exit(0);
+    }
+
+    char ok = 0;
+
+    if (read(ready[0], &ok, 1) != 1 || !ok)
+    {
+        waitpid(child, NULL, 0);
+        return 1;
+    }
+
+    ShmRingbuffer ring;
+
+    if (!ring.attach(name))
+    {
+        fprintf(stderr, "%s\n", ring.error().c_str());
+        kill(child, SIGTERM);
+        waitpid(child, NULL, 0);
+        return 1;
+    }
+
+    show_header(ring, name);
+
+    unsigned long received = 0;
+    unsigned long invalid  = 0;
+
+    /* each producer publishes its range in order */
+    unsigned long * next = new unsigned long[producers];
+
+    for (unsigned int i = 0; i < producers; i++)
+        next[i] = (total / producers) * i;
+
+    const uint64_t start = now_us();
+
+    write(go[1], &ok, 1);
+
+    while (received < total)
+    {
+        ShmRingbuffer::Slot * slot = ring.consumer_start();
+
+        if (!slot)
+        {
+            sched_yield();
+            continue;
+        }
+
+        const ShmRecord & rec = *(const ShmRecord *)slot->data;
+
+        const unsigned long i = (unsigned long)rec.add_info;
+        const unsigned int  p = std::min((unsigned int)(i / (total / producers)), producers - 1);
+
+        if (i != next[p] || rec.size != 160 || rec.data[159] != (char)(i & 0xff))
+            ++invalid;
+
+        next[p] = i + 1;
+
+        ring.consumer_commit();
+        ++received;
+    }
+
+    const double elapsed = (double)(now_us() - start) / 1000000.0;
+
+    write(go[1], &ok, 1);
+    waitpid(child, NULL, 0);
+
+    printf("%lu records in %.3f s: %.0f records/s, %.1f MB/s of audio, %lu out of order/corrupt\n",
+        received, elapsed, (double)received / elapsed, ((double)received * 160.0) / (elapsed * 1000000.0), invalid);
+
+    delete[] next;
+
+    return (invalid ? 1 : 0);
+}
+
+static void usage(const char * prog)
+{
+    fprintf(stderr,
+        "usage: %s [-s segment] [-a] [-c bNcM -w prefix]\n"
+        "       %s -b records [-p producers] [-n slots]\n", prog, prog);
+}
+
+int main(int argc, char ** argv)
+{
+    std::string   name      = "/khomp";
+    std::string   prefix;
+    bool          all_audio = false;
+    int           device    = -1;
+    int           object    = -1;
+    unsigned long bench     = 0;
+    unsigned int  producers = 1;
+    unsigned int  slots     = 8192;
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:ac:w:b:p:n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': name = (optarg[0] == '/' ? "" : "/"); name += optarg; break;
+            case 'a': all_audio = true;                                    break;
+            case 'w': prefix    = optarg;                                  break;
+            case 'b': bench     = strtoul(optarg, NULL, 10);               break;
+            case 'p': producers = (unsigned int)atoi(optarg);              break;
+            case 'n': slots     = (unsigned int)atoi(optarg);              break;
+
+            case 'c':
+                if (sscanf(optarg, "b%dc%d", &device, &object) != 2)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (bench)
+        return benchmark(bench, (producers ? producers : 1), (slots ? slots : 1));
+
+    if (!prefix.empty() && device < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT,  stop);
+    signal(SIGTERM, stop);
+
+    return read_loop(name, all_audio, device, object, prefix);
+}